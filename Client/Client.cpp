@@ -8,6 +8,7 @@
 // file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
 //
 
+#include <atomic>
 #include <cstdlib>
 #include <deque>
 #include <iostream>
@@ -19,11 +20,12 @@
 #endif
 #include "Message.hpp"
 #include "Shape.h"
+#include "Viewer.h"
 
 using boost::asio::ip::tcp;
 using namespace Patchwork;
 
-typedef std::deque<Message> Message_queue;
+typedef std::deque<Message_ptr> Message_queue;
 
 /*! \file Client.cpp
 \brief File containing the client part of the application
@@ -42,22 +44,27 @@ public:
 	\param io_service The boost::asio io_service providing event polling on the socket
 	\param endpoint_iterator The boost::asio TCP iterator
 	\param img Reference to the image currently owned by the Client (so we can send it)
+	\param max_batch_bytes Cap on the bytes of queued messages gathered into one write (a bigger message is still written alone)
 	*/
   ClientIO(boost::asio::io_service& io_service,
       tcp::resolver::iterator endpoint_iterator,
-	  Image& img)
+	  Image& img,
+	  std::size_t max_batch_bytes = Message::max_batch_length)
     : io_service_(io_service),
       socket_(io_service),
-	  img(img)
+	  img(img),
+	  encoding_(TEXT),
+	  max_batch_bytes_(max_batch_bytes),
+	  batch_size_(0)
   {
 	  //Check for connection
     do_connect(endpoint_iterator);
   }
   /*!
-  Tells the socket that we want to write a message
+  Tells the socket that we want to write a message, only the shared pointer is copied into the io_service
   \param msg the message to send
   */
-  void write(const Message& msg)
+  void write(const Message_ptr& msg)
   {
     io_service_.post(
         [this, msg]()
@@ -71,6 +78,13 @@ public:
         });
   }
   /*!
+  Encoding to use when sending the image, binary once the server answered our HELLO with binary support
+  */
+  Encoding encoding() const
+  {
+    return encoding_;
+  }
+  /*!
   Tells the socket that we want to close the connection
   */
   void close()
@@ -90,77 +104,120 @@ private:
         {
           if (!ec)
           {
-            do_read_header();
+            //Advertise the encodings we can read before anything else
+            write(make_hello((1 << TEXT) | (1 << BINARY)));
+            do_read();
           }
         });
   }
   /*!
-  Read from the socket into a buffer and analyze our message header, then ask to read the message's body
+  Read from the socket as much as it has into the connection's buffer, handle every complete message it holds,
+  then start again to read from the socket (due to asynchronous design)
   */
-  void do_read_header()
+  void do_read()
   {
-    boost::asio::async_read(socket_,
-        boost::asio::buffer(read_msg_.data(), Message::header_length),
-        [this](boost::system::error_code ec, std::size_t /*length*/)
+    std::size_t size;
+    char* data = reader_.prepare(size);
+    socket_.async_read_some(boost::asio::buffer(data, size),
+        [this](boost::system::error_code ec, std::size_t length)
         {
-          if (!ec && read_msg_.decode_header())
-          {
-            do_read_body();
-          }
-          else
+          if (!ec)
           {
-            socket_.close();
+            reader_.commit(length);
+            Message_view msg;
+            while (reader_.next(msg))
+            {
+              handle_message(msg);
+            }
+            if (!reader_.error())
+            {
+              do_read();
+              return;
+            }
           }
+          socket_.close();
         });
   }
   /*!
-  Read from the socket into a buffer and analyze our message body, then start again to read from the socket is some reads are needed to be done (due to asynchronous design)
+  React to a message according to its opcode : a HELLO or an ACK from the server, a GET asking for our image,
+  an image sent back or an annotation
   */
-  void do_read_body()
+  void handle_message(const Message_view& msg)
   {
-    boost::asio::async_read(socket_,
-        boost::asio::buffer(read_msg_.body(), read_msg_.body_length()),
-        [this](boost::system::error_code ec, std::size_t /*length*/)
-        {
-          if (!ec)
-          {
-			  if (std::string(read_msg_.body()) == "GET")
+	  switch (msg.opcode)
+	  {
+		  case Message::HELLO:
+		  {
+			  //The server told us what it can read
+			  unsigned char encodings = msg.length ? static_cast<unsigned char>(msg.body[0]) : 0;
+			  encoding_ = (encodings & (1 << BINARY)) ? BINARY : TEXT;
+		  }break;
+
+		  case Message::ACK:
+		  {
+			  //The server holds this version of our image
+			  if (msg.length == 4)
+				  img.acknowledge(read_uint32(msg.body));
+		  }break;
+
+		  case Message::GET:
+		  {
+			  //Send only what changed since the version the server acknowledged, or the whole image, answering this request
+			  Encoding encoding = encoding_;
+			  std::string s;
+			  Message::Opcode opcode = Message::DELTA;
+			  if (encoding != BINARY || !img.serialize_delta(s))
 			  {
-				  //Send image
-				  Message msg;
-				  std::string s;
-				  img.serialize(s);
-				  msg.body_length(s.length());
-				  std::memcpy(msg.body(), s.c_str(), msg.body_length());
-				  msg.encode_header();
-				  write(msg);
+				  opcode = Message::IMAGE;
+				  img.serialize(s, encoding);
 			  }
+			  std::shared_ptr<Message> reply = std::make_shared<Message>(opcode, encoding == BINARY ? Message::BINARY_BODY : 0, msg.request_id);
+			  if (reply->set_body(s))
+				  write(reply);
 			  else
-			  {
-				  //Get image
-				  img.deserialize(std::string(read_msg_.body()));
-			  }
-            do_read_header();
-          }
-          else
-          {
-            socket_.close();
-          }
-        });
+				  std::cout << "Image is too large to be sent" << std::endl;
+		  }break;
+
+		  case Message::IMAGE:
+		  {
+			  //Get image, an open window shows it
+			  img.deserialize(msg.body, msg.length);
+			  Viewer::notify();
+		  }break;
+
+		  case Message::ANNOTATE:
+		  {
+			  img.annotate(std::string(msg.body, msg.length));
+		  }break;
+
+		  default:
+		  {
+			  std::cout << "Unknown message " << (int)msg.opcode << std::endl;
+		  }
+	  }
   }
   /*!
   Write to the socket, then ask to write again if some writes are needed to be done (due to asychronous design)
+  Every queued message fitting in max_batch_bytes_ is gathered into a single write, so a burst costs one write, not one per message
   */
   void do_write()
   {
-    boost::asio::async_write(socket_,
-        boost::asio::buffer(write_msgs_.front().data(),
-          write_msgs_.front().length()),
+    std::size_t bytes = 0;
+    write_buffers_.clear();
+    for (batch_size_ = 0; batch_size_ < write_msgs_.size(); ++batch_size_)
+    {
+      const Message_ptr& msg = write_msgs_[batch_size_];
+      if (batch_size_ && bytes + msg->length() > max_batch_bytes_)
+        break;
+      write_buffers_.push_back(boost::asio::buffer(msg->data(), msg->length()));
+      bytes += msg->length();
+    }
+    boost::asio::async_write(socket_, write_buffers_,
         [this](boost::system::error_code ec, std::size_t /*length*/)
         {
           if (!ec)
           {
-            write_msgs_.pop_front();
+            write_msgs_.erase(write_msgs_.begin(), write_msgs_.begin() + batch_size_);
             if (!write_msgs_.empty())
             {
               do_write();
@@ -176,9 +233,13 @@ private:
 private:
   boost::asio::io_service& io_service_; /*!< boost::asio IO service */
   tcp::socket socket_; /*!< boost::asio TCP Socket */
-  Message read_msg_; /*!< Message read from the socket */
+  Message_reader reader_; /*!< Buffer of the bytes read from the socket, reused from one read to the next */
   Message_queue write_msgs_; /*!< Queue of messages to be sent */
   Image& img; /*!< REference to the image currently owned by the Client */
+  std::atomic<Encoding> encoding_; /*!< Encoding negotiated with the server through HELLO messages */
+  std::vector<boost::asio::const_buffer> write_buffers_; /*!< Buffers of the messages being written, reused from one write to the next */
+  std::size_t max_batch_bytes_; /*!< Cap on the bytes gathered into one write */
+  std::size_t batch_size_; /*!< Number of messages, at the front of the queue, being written */
 };
 
 /*!
@@ -217,8 +278,9 @@ public :
 	\param ip TCP Socket IP
 	\param port TCP Socket port
 	\param service boost::asio io_service
+	\param max_fps Frame cap of the window, 0 for none
 	*/
-	Client(std::string ip, std::string port, boost::asio::io_service& service) : io_service(service)
+	Client(std::string ip, std::string port, boost::asio::io_service& service, int max_fps = 60) : max_fps(max_fps), io_service(service)
 	{
 		img = new Image();
 		//Initiliaze connection
@@ -270,18 +332,11 @@ private:
 					//Print annotation in console
 					std::cout << "Annotation : " << img->get_annotation() << std::endl;
 					//Create window and display image
-					SDL_CreateWindowAndRenderer(800, 600, 0, &window, &renderer);
-					while (1) {
-						SDL_PollEvent(&event);
-						if (event.type == SDL_QUIT) {
-							break;
-						}
-						SDL_SetRenderDrawColor(renderer, 255, 255, 255, 0x00);
-						SDL_RenderClear(renderer);
-						img->display(renderer);
-						SDL_RenderPresent(renderer);
+					{
+						//Drawn again only when the image changed, each frame is otherwise a single blit
+						Viewer viewer("Image", max_fps);
+						viewer.run([&](Canvas& canvas) { img->display_cached(canvas); }, [&]() { return img->revision(); });
 					}
-					SDL_DestroyWindow(window);
 				}break;
 
 				case Commands::HELP:
@@ -325,7 +380,7 @@ private:
 									std::cin.clear();
 									throw std::domain_error("Bad input");
 								}
-								img->add_component(new Circle(Vec2(x, y), radius, Color(r, g, b)));
+								img->add_component(img->make<Circle>(Vec2(x, y), radius, Color(r, g, b)));
 								std::cout << "Circle created" << std::endl;
 							}
 							catch (std::exception& e)
@@ -360,7 +415,7 @@ private:
 									std::cin.clear();
 									throw std::domain_error("Bad input");
 								}
-								img->add_component(new Patchwork::Ellipse(Vec2(x, y), Vec2(rad_x, rad_y), Color(r, g, b)));
+								img->add_component(img->make<Patchwork::Ellipse>(Vec2(x, y), Vec2(rad_x, rad_y), Color(r, g, b)));
 								std::cout << "Ellipse created" << std::endl;
 							}
 							catch (std::exception& e)
@@ -395,7 +450,7 @@ private:
 									std::cin.clear();
 									throw std::domain_error("Bad input");
 								}
-								img->add_component(new Patchwork::Line(Vec2(x, y), Vec2(dir_x, dir_y), Color(r, g, b)));
+								img->add_component(img->make<Patchwork::Line>(Vec2(x, y), Vec2(dir_x, dir_y), Color(r, g, b)));
 								std::cout << "Line created" << std::endl;
 							}
 							catch (std::exception& e)
@@ -435,7 +490,7 @@ private:
 									std::cin.clear();
 									throw std::domain_error("Bad input");
 								}
-								img->add_component(new Patchwork::Polygon(points, Color(r, g, b)));
+								img->add_component(img->make<Patchwork::Polygon>(points, Color(r, g, b)));
 								std::cout << "Polygon created" << std::endl;
 							}
 							catch (std::exception& e)
@@ -455,13 +510,14 @@ private:
 				case Commands::SEND:
 				{
 					// Send the image to the server
-					Message msg;
+					Encoding encoding = c->encoding();
+					std::shared_ptr<Message> msg = std::make_shared<Message>(Message::IMAGE, encoding == BINARY ? Message::BINARY_BODY : 0);
 					std::string serial;
-					img->serialize(serial);
-					msg.body_length(serial.size());
-					std::memcpy(msg.body(), serial.c_str(), msg.body_length());
-					msg.encode_header();
-					c->write(msg);
+					img->serialize(serial, encoding);
+					if (msg->set_body(serial))
+						c->write(msg);
+					else
+						std::cout << "Image is too large to be sent" << std::endl;
 				}break;
 
 				case Commands::TRANSFORM:
@@ -506,6 +562,7 @@ private:
 									throw std::domain_error("Bad input");
 								}
 								img->components().at(id)->homothety(ratio);
+								img->mark_changed(id);
 							}
 							catch (std::exception& e)
 							{
@@ -532,6 +589,7 @@ private:
 									throw std::domain_error("Bad input");
 								}
 								img->components().at(id)->axialSym(Vec2(x, y), Vec2(dir_x, dir_y));
+								img->mark_changed(id);
 							}
 							catch (std::exception& e)
 							{
@@ -554,6 +612,7 @@ private:
 									throw std::domain_error("Bad input");
 								}
 								img->components().at(id)->centralSym(Vec2(x, y));
+								img->mark_changed(id);
 							}
 							catch (std::exception& e)
 							{
@@ -574,6 +633,7 @@ private:
 									throw std::domain_error("Bad input");
 								}
 								img->components().at(id)->rotate(DEGTORAD*angle);
+								img->mark_changed(id);
 							}
 							catch (std::exception& e)
 							{
@@ -596,6 +656,7 @@ private:
 									throw std::domain_error("Bad input");
 								}
 								img->components().at(id)->translate(Vec2(x, y));
+								img->mark_changed(id);
 							}
 							catch (std::exception& e)
 							{
@@ -631,9 +692,7 @@ private:
 							std::cin.clear();
 							throw std::domain_error("Bad input");
 						}
-						auto tmp = img->components().at( id ); // test to throw exception
-						auto it = img->components().begin() + id;
-						img->components().erase(it);
+						img->remove_component(id); // throw if there is no such component
 					}
 					catch (std::exception& e)
 					{
@@ -678,9 +737,7 @@ private:
 	}
 
 	ClientIO* c; /*!< The Client Input/Output on socket */
-	SDL_Event event; /*!< SDL Event so we can know when to close the window */
-	SDL_Window *window; /*!< SDL window to display to */
-	SDL_Renderer *renderer; /*!< SDL renderer to draw components to */
+	int max_fps; /*!< Frame cap of the window, 0 for none */
 	boost::asio::io_service& io_service; /*!< boost::asio io_service */
 	tcp::resolver* resolver; /*!< boost::asio TCP resolver */
 	std::thread* t; /*!< Thread polling Input/Output event from io_service */
@@ -691,12 +748,22 @@ const std::vector<std::string> Client::cmds = { "display", "make", "transform",
 #if _WIN32
 int _tmain(int argc, _TCHAR* argv[])
 #else
-int main()
+int main(int argc, char* argv[])
 #endif
 {
+  //Argument, optional : the frame cap of the window (60 by default, 0 for none)
+  int max_fps = 60;
+  if (argc > 1)
+  {
+#if _WIN32
+	max_fps = std::max(0, (int)_ttol(argv[1]));
+#else
+	max_fps = std::max(0, atoi(argv[1]));
+#endif
+  }
   //Create io_service and start Client
   boost::asio::io_service io_service;
   //Client will be cleaned by app
-  Client c("127.0.0.1", "8080", io_service);
+  Client c("127.0.0.1", "8080", io_service, max_fps);
   return 0;
 }
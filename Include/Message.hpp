@@ -10,29 +10,87 @@
 
 #pragma once
 
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
 
+/*!
+Read a 32 bits unsigned integer stored big endian (network order) at data
+*/
+inline uint32_t read_uint32(const char* data)
+{
+  const unsigned char* b = reinterpret_cast<const unsigned char*>(data);
+  return (static_cast<uint32_t>(b[0]) << 24) | (static_cast<uint32_t>(b[1]) << 16)
+    | (static_cast<uint32_t>(b[2]) << 8) | static_cast<uint32_t>(b[3]);
+}
+
+/*!
+Write a 32 bits unsigned integer big endian (network order) at data
+*/
+inline void write_uint32(char* data, uint32_t v)
+{
+  data[0] = static_cast<char>((v >> 24) & 0xFF);
+  data[1] = static_cast<char>((v >> 16) & 0xFF);
+  data[2] = static_cast<char>((v >> 8) & 0xFF);
+  data[3] = static_cast<char>(v & 0xFF);
+}
+
+/*!
+A framed message : a 12 bytes binary header followed by the body.
+The header holds, in network order, the body length (4 bytes), the opcode (1 byte), the flags (1 byte),
+2 reserved bytes and the request ID (4 bytes). A response carries the request ID of the message it answers.
+The storage is a growable buffer, so a Message kept alive and reused only reallocates when a bigger body than any previous one arrives.
+*/
 class Message
 {
 public:
-  enum { header_length = 4 };
-  enum { max_body_length = 512 };
+  enum { header_length = 12 };
+  enum { max_body_length = 64 * 1024 * 1024 }; /*!< Upper bound accepted from the wire, protects against corrupted headers */
+  enum { max_batch_length = 64 * 1024 }; /*!< Default cap on the bytes gathered into a single write of queued messages */
+  /*!
+  Kinds of message :
+  HELLO advertises the encodings a peer can read (body : one bit per encoding),
+  GET asks a client for its image (empty body),
+  IMAGE carries a whole image and DELTA the changes since the acknowledged version,
+  ACK gives the version of the client's image the server holds (body : 4 bytes),
+  ANNOTATE carries the annotation the server gave to the client's image.
+  */
+  enum Opcode { HELLO = 1, GET, IMAGE, DELTA, ACK, ANNOTATE };
+  enum Flags { BINARY_BODY = 1 << 0 }; /*!< The body is encoded in binary rather than text */
+
+  Message(Opcode opcode = IMAGE, unsigned char flags = 0, uint32_t request_id = 0)
+    : data_(header_length), body_length_(0), opcode_(opcode), flags_(flags), request_id_(request_id)
+  {
+    encode_header();
+  }
+
+  Opcode opcode() const
+  {
+    return opcode_;
+  }
+
+  unsigned char flags() const
+  {
+    return flags_;
+  }
 
-  Message()
-    : body_length_(0)
+  uint32_t request_id() const
   {
+    return request_id_;
   }
 
   const char* data() const
   {
-    return data_;
+    return data_.data();
   }
 
   char* data()
   {
-    return data_;
+    return data_.data();
   }
 
   std::size_t length() const
@@ -42,12 +100,12 @@ public:
 
   const char* body() const
   {
-    return data_ + header_length;
+    return data_.data() + header_length;
   }
 
   char* body()
   {
-    return data_ + header_length;
+    return data_.data() + header_length;
   }
 
   std::size_t body_length() const
@@ -60,29 +118,200 @@ public:
     body_length_ = new_length;
     if (body_length_ > max_body_length)
       body_length_ = max_body_length;
+    data_.resize(header_length + body_length_);
+  }
+
+  /*!
+  Copy s into the body and encode the header.
+  Return false, leaving the message untouched, if s does not fit in max_body_length.
+  */
+  bool set_body(const std::string& s)
+  {
+    if (s.size() > max_body_length)
+      return false;
+    body_length(s.size());
+    std::memcpy(body(), s.data(), s.size());
+    encode_header();
+    return true;
+  }
+
+  /*!
+  Read the body length held by the header at data
+  */
+  static std::size_t decode_length(const char* data)
+  {
+    return read_uint32(data);
   }
 
   bool decode_header()
   {
-    char header[header_length + 1] = "";
-    std::strncat(header, data_, header_length);
-    body_length_ = std::atoi(header);
-    if (body_length_ > max_body_length)
+    std::size_t length = decode_length(data_.data());
+    if (length > max_body_length)
     {
       body_length_ = 0;
       return false;
     }
+    body_length(length);
+    opcode_ = static_cast<Opcode>(static_cast<unsigned char>(data_[4]));
+    flags_ = static_cast<unsigned char>(data_[5]);
+    request_id_ = read_uint32(&data_[8]);
     return true;
   }
 
   void encode_header()
   {
-    char header[header_length + 1] = "";
-    std::sprintf(header, "%4d", static_cast<int>(body_length_));
-    std::memcpy(data_, header, header_length);
+    write_uint32(&data_[0], static_cast<uint32_t>(body_length_));
+    data_[4] = static_cast<char>(opcode_);
+    data_[5] = static_cast<char>(flags_);
+    data_[6] = 0;
+    data_[7] = 0;
+    write_uint32(&data_[8], request_id_);
   }
 
 private:
-  char data_[header_length + max_body_length];
+  std::vector<char> data_; /*!< Header followed by the body, grown on demand and never shrunk */
   std::size_t body_length_;
+  Opcode opcode_; /*!< Kind of message */
+  unsigned char flags_; /*!< Combination of Flags */
+  uint32_t request_id_; /*!< ID of the request, or of the request answered */
+};
+
+/*!
+View over a message held in a Message_reader : its header fields and its body, valid until the next read
+*/
+struct Message_view
+{
+  Message::Opcode opcode; /*!< Kind of message */
+  unsigned char flags; /*!< Combination of Message::Flags */
+  uint32_t request_id; /*!< ID of the request, or of the request answered */
+  const char* body; /*!< First byte of the body */
+  std::size_t length; /*!< Length of the body */
 };
+
+/*!
+Per connection read buffer : a socket read fills it with as much as is available, then every complete message
+it holds is extracted before the next read, so pipelined messages cost one read instead of two each.
+Consumed bytes are reclaimed by moving the unread tail back to the front before reading again, and the buffer only
+grows when a message bigger than it arrives, so there is no allocation per message.
+*/
+class Message_reader
+{
+public:
+  enum { min_read_length = 16 * 1024 }; /*!< Smallest free space offered to a socket read */
+
+  Message_reader()
+    : buffer_(min_read_length), begin_(0), end_(0), error_(false)
+  {
+  }
+
+  /*!
+  Return where to read into and set size to the free space there.
+  It is at least min_read_length, and enough to complete the pending message.
+  Pointers given by next() are invalidated.
+  */
+  char* prepare(std::size_t& size)
+  {
+    std::size_t needed = min_read_length;
+    std::size_t pending = end_ - begin_;
+    if (pending >= Message::header_length)
+    {
+      //An invalid length is rejected by next(), it must not make the buffer grow first
+      std::size_t length = Message::decode_length(&buffer_[begin_]);
+      std::size_t frame = Message::header_length + length;
+      if (length <= Message::max_body_length && frame > pending + needed)
+        needed = frame - pending;
+    }
+    if (begin_ == end_)
+    {
+      begin_ = end_ = 0;
+    }
+    else if (begin_ && buffer_.size() - end_ < needed)
+    {
+      std::memmove(&buffer_[0], &buffer_[begin_], pending);
+      begin_ = 0;
+      end_ = pending;
+    }
+    if (buffer_.size() - end_ < needed)
+      buffer_.resize(end_ + needed);
+    size = buffer_.size() - end_;
+    return &buffer_[end_];
+  }
+
+  /*!
+  Record that n bytes were read at the location given by prepare()
+  */
+  void commit(std::size_t n)
+  {
+    end_ += n;
+  }
+
+  /*!
+  Extract the next complete message. Return false if there is none, or if the header is invalid (then error() is true).
+  The view is valid until the next call to prepare().
+  */
+  bool next(Message_view& msg)
+  {
+    std::size_t pending = end_ - begin_;
+    if (error_ || pending < Message::header_length)
+      return false;
+    const char* header = &buffer_[begin_];
+    msg.length = Message::decode_length(header);
+    if (msg.length > Message::max_body_length)
+    {
+      error_ = true;
+      return false;
+    }
+    if (pending < Message::header_length + msg.length)
+      return false;
+    msg.opcode = static_cast<Message::Opcode>(static_cast<unsigned char>(header[4]));
+    msg.flags = static_cast<unsigned char>(header[5]);
+    msg.request_id = read_uint32(header + 8);
+    msg.body = header + Message::header_length;
+    begin_ += Message::header_length + msg.length;
+    return true;
+  }
+
+  /*!
+  True once an invalid header was met, the connection can't be trusted anymore
+  */
+  bool error() const
+  {
+    return error_;
+  }
+
+private:
+  std::vector<char> buffer_; /*!< Read bytes, the unread ones lie in [begin_, end_) */
+  std::size_t begin_; /*!< First unread byte */
+  std::size_t end_; /*!< One past the last read byte */
+  bool error_; /*!< An invalid header was met */
+};
+
+/*!
+An encoded message shared, read only, by every write queue it is delivered to and by the pending async_write.
+A broadcast is encoded once however many participants receive it.
+*/
+typedef std::shared_ptr<const Message> Message_ptr;
+
+/*!
+Build the HELLO message a peer sends right after connecting to advertise the encodings it can read,
+its body is a byte holding one bit per encoding. A text only peer never sends it, so its connection simply stays in text.
+*/
+inline Message_ptr make_hello(unsigned char encodings)
+{
+  std::shared_ptr<Message> msg = std::make_shared<Message>(Message::HELLO);
+  msg->set_body(std::string(1, static_cast<char>(encodings)));
+  return msg;
+}
+
+/*!
+Build the ACK message the server sends after applying a binary image or delta, answering the request that carried it.
+Its body is the version of the client's image the server now holds, the client sends its next delta from that version.
+*/
+inline Message_ptr make_ack(uint32_t version, uint32_t request_id)
+{
+  char body[4];
+  write_uint32(body, version);
+  std::shared_ptr<Message> msg = std::make_shared<Message>(Message::ACK, 0, request_id);
+  msg->set_body(std::string(body, 4));
+  return msg;
+}
@@ -8,14 +8,17 @@
 // file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
 //
 
+#include <atomic>
 #include <cstdlib>
 #include <deque>
 #include <iostream>
 #include <list>
 #include <memory>
-#include <set>
+#include <mutex>
 #include <thread>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 #include <stdio.h>
 #if _WIN32
 #include <tchar.h>
@@ -23,6 +26,7 @@
 #include <boost/asio.hpp>
 #include "Message.hpp"
 #include "Shape.h"
+#include "Viewer.h"
 
 using boost::asio::ip::tcp;
 using namespace Patchwork;
@@ -34,7 +38,39 @@ using namespace Patchwork;
 
 //----------------------------------------------------------------------
 
-typedef std::deque<Message> Message_queue;
+typedef std::deque<Message_ptr> Message_queue;
+
+/*!
+Limits of the write queue of each client, so a stalled client can't make the server buffer every message forever.
+Only the messages waiting behind the write in progress count, and a message alone in the queue is always accepted.
+*/
+struct Write_limits
+{
+	enum Policy { DROP_OLDEST = 0, COALESCE_IMAGE, DISCONNECT }; /*!< What to do when a message would overflow the queue */
+
+	Write_limits(std::size_t max_messages = 256,
+		std::size_t max_bytes = Message::header_length + Message::max_body_length,
+		Policy policy = COALESCE_IMAGE,
+		std::size_t max_batch_bytes = Message::max_batch_length)
+		: max_messages(max_messages), max_bytes(max_bytes), policy(policy), max_batch_bytes(max_batch_bytes) {}
+
+	std::size_t max_messages; /*!< Cap on the number of queued messages */
+	std::size_t max_bytes; /*!< Cap on the bytes of queued messages */
+	Policy policy; /*!< DROP_OLDEST drops the oldest messages, COALESCE_IMAGE replaces the queued images by the new one before dropping, DISCONNECT closes the connection */
+	std::size_t max_batch_bytes; /*!< Cap on the bytes of queued messages gathered into one write (a bigger message is still written alone) */
+};
+
+/*!
+Counters of how often the write limits were hit, shared by every client
+*/
+struct Write_stats
+{
+	Write_stats() : dropped(0), coalesced(0), disconnected(0) {}
+
+	std::atomic<uint64_t> dropped; /*!< Messages dropped to make room for newer ones */
+	std::atomic<uint64_t> coalesced; /*!< Queued images replaced by a newer image */
+	std::atomic<uint64_t> disconnected; /*!< Clients disconnected because their queue was full */
+};
 
 //----------------------------------------------------------------------
 /*!
@@ -45,9 +81,12 @@ class ClientConnection
 {
 public:
 	virtual ~ClientConnection() {}
-  virtual void deliver(const Message& msg) = 0;
+  virtual void deliver(const Message_ptr& msg) = 0;
   Image* img; /*!< The image linked to the client */
   int ID; /*!< unique ID identifying the client */
+  std::atomic<Encoding> encoding; /*!< Encoding used to send images to the client, negotiated with its HELLO */
+  std::atomic<uint32_t> answered_request; /*!< Request ID of the last GET the client answered with its image */
+  std::mutex img_mutex; /*!< Guards img, the console reads it while an I/O thread deserializes into it */
 };
 
 typedef std::shared_ptr<ClientConnection> ClientConnection_ptr;
@@ -56,34 +95,60 @@ typedef std::shared_ptr<ClientConnection> ClientConnection_ptr;
 
 /*!
 The room is responsible for maintening an updated list of client and 
+Clients join and leave from any thread of the I/O pool. The list is an immutable snapshot indexed by client ID :
+a join or a leave publishes a new snapshot, readers only take a reference to the current one,
+so they never lock nor copy the list and keep a consistent view while clients come and go (RCU-style)
 */
 class Room
 {
 public:
+	typedef std::unordered_map<int, ClientConnection_ptr> Participants; /*!< Participants indexed by their ID */
+	typedef std::shared_ptr<const Participants> Participants_ptr; /*!< A snapshot of the participants, never modified once published */
+
+	Room() : participants_(std::make_shared<Participants>()) {}
 	/*!
 	Add participant to the room
 	*/
    void join(ClientConnection_ptr participant)
   {
-    participants_.insert(participant);
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::shared_ptr<Participants> next = std::make_shared<Participants>(*participants_);
+    (*next)[participant->ID] = participant;
+    std::atomic_store(&participants_, Participants_ptr(next));
   }
    /*!
-   Delete participant from the room
+   Delete participant from the room, does nothing if it already left
    */
 	void leave(ClientConnection_ptr participant)
   {
-    participants_.erase(participant);
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = participants_->find(participant->ID);
+    if (it == participants_->end() || it->second != participant)
+      return;
+    std::shared_ptr<Participants> next = std::make_shared<Participants>(*participants_);
+    next->erase(participant->ID);
+    std::atomic_store(&participants_, Participants_ptr(next));
+  }
+	/*!
+	Getter of the current snapshot of the participants of the room
+	*/
+  Participants_ptr participants() const
+  {
+	  return std::atomic_load(&participants_);
   }
 	/*!
-	Getter of participant list of the room
+	Find a participant by its ID, return nullptr if there is none
 	*/
-  std::set<ClientConnection_ptr> participants()
+  ClientConnection_ptr find(int ID) const
   {
-	  return participants_;
+	  Participants_ptr snapshot = participants();
+	  auto it = snapshot->find(ID);
+	  return it != snapshot->end() ? it->second : nullptr;
   }
 
 private:
-	std::set<ClientConnection_ptr> participants_;  /*!< List of participants */
+	Participants_ptr participants_;  /*!< Current snapshot of the participants, swapped atomically */
+	std::mutex mutex_; /*!< Serializes the writers, readers never take it */
 };
 
 //----------------------------------------------------------------------
@@ -91,6 +156,8 @@ private:
 
 /*!
 The Client class handle the client, joining the room and being the one doing asynchronous operations.
+Every handler of a client runs through its own strand, so a client is never handled by two threads at once
+while different clients are handled in parallel by the I/O pool.
 */
 class Client
   : public ClientConnection,
@@ -99,13 +166,26 @@ class Client
 public:
 	/*!
 	Create a client with an associated socket, room, image and ID
+	\param io_service io_service running the client's strand
+	\param limits Limits of the write queue and policy applied when it is full
+	\param stats Counters updated when the limits are hit
 	*/
-  Client(tcp::socket socket, Room& room, int ID)
+  Client(tcp::socket socket, boost::asio::io_service& io_service, Room& room, int ID, const Write_limits& limits, Write_stats& stats)
     : socket_(std::move(socket)),
-      room_(room)
+      strand_(io_service),
+      room_(room),
+      limits_(limits),
+      stats_(stats),
+      batch_size_(0),
+      queued_bytes_(0),
+      closed_(false)
   {
 	  this->ID = ID;
+	  encoding = TEXT;
+	  answered_request = 0;
 	  img = new Image();
+	  //Indexed so the console can pick shapes and the viewer skips what is out of sight
+	  img->enable_index();
   }
   /*!
   Join the room and try to read from the socket
@@ -113,79 +193,204 @@ public:
   void start()
   {
     room_.join(shared_from_this());
-    do_read_header();
+    do_read();
   }
   /*!
-  Write messages
+  Write messages, only the pointer is queued so a broadcast message is shared by every participant
+  Can be called from any thread, the queue is only touched from the client's strand
   */
-  void deliver(const Message& msg)
+  void deliver(const Message_ptr& msg)
   {
-    bool write_in_progress = !write_msgs_.empty();
-    write_msgs_.push_back(msg);
-    if (!write_in_progress)
+    auto self(shared_from_this());
+    strand_.dispatch([this, self, msg]()
     {
-      do_write();
-    }
+      if (closed_)
+        return;
+      bool write_in_progress = !write_msgs_.empty();
+      write_msgs_.push_back(msg);
+      queued_bytes_ += msg->length();
+      if (!enforce_limits())
+        return;
+      if (!write_in_progress)
+      {
+        do_write();
+      }
+    });
   }
 
 private:
 	/*!
-	Read from the socket into a buffer and analyze our message header, then ask to read the message's body
+	Read from the socket as much as it has into the connection's buffer, handle every complete message it holds,
+	then start again to read from the socket (due to asynchronous design)
 	*/
-  void do_read_header()
+  void do_read()
   {
     auto self(shared_from_this());
-    boost::asio::async_read(socket_,
-        boost::asio::buffer(read_msg_.data(), Message::header_length),
-        [this, self](boost::system::error_code ec, std::size_t /*length*/)
+    std::size_t size;
+    char* data = reader_.prepare(size);
+    socket_.async_read_some(boost::asio::buffer(data, size),
+        strand_.wrap([this, self](boost::system::error_code ec, std::size_t length)
         {
-          if (!ec && read_msg_.decode_header())
-          {
-            do_read_body();
-          }
-          else
+          if (!ec)
           {
-            room_.leave(shared_from_this());
+            reader_.commit(length);
+            Message_view msg;
+            while (reader_.next(msg))
+            {
+              handle_message(msg);
+            }
+            if (!reader_.error())
+            {
+              do_read();
+              return;
+            }
           }
-        });
+          room_.leave(shared_from_this());
+        }));
   }
   /*!
-  Read from the socket into a buffer and analyze our message body, then start again to read from the socket is some reads are needed to be done (due to asynchronous design)
-  If it has something to read, it's an image so it deserialize it
+  React to a message according to its opcode.
+  A HELLO sets the encoding used for this client, an IMAGE or a DELTA answers a GET so it deserialize it and acknowledge it
   */
-  void do_read_body()
+  void handle_message(const Message_view& msg)
   {
-    auto self(shared_from_this());
-    boost::asio::async_read(socket_,
-        boost::asio::buffer(read_msg_.body(), read_msg_.body_length()),
-        [this, self](boost::system::error_code ec, std::size_t /*length*/)
+	switch (msg.opcode)
+	{
+		case Message::HELLO:
+		{
+			//Answer with what we support, from now on images are sent to this client in binary if it can read it
+			unsigned char encodings = msg.length ? static_cast<unsigned char>(msg.body[0]) : 0;
+			encoding = (encodings & (1 << BINARY)) ? BINARY : TEXT;
+			deliver(make_hello((1 << TEXT) | (1 << BINARY)));
+		}break;
+
+		case Message::DELTA:
+		case Message::IMAGE:
+		{
+			if (msg.opcode == Message::DELTA && !(msg.flags & Message::BINARY_BODY))
+			{
+				std::cout << "Delta of client " << ID << " ignored : deltas are binary only" << std::endl;
+				break;
+			}
+			uint32_t version;
+			{
+				std::lock_guard<std::mutex> lock(img_mutex);
+				img->deserialize(msg.body, msg.length);
+				version = img->received_version();
+			}
+			//An open window showing this image draws it again
+			Viewer::notify();
+			answered_request = msg.request_id;
+			//Tell a binary client which version we hold, so it only sends what changed next time
+			if (encoding == BINARY && version)
+				deliver(make_ack(version, msg.request_id));
+		}break;
+
+		default:
+		{
+			std::cout << "Unknown message " << (int)msg.opcode << " from client " << ID << std::endl;
+		}
+	}
+  }
+  /*!
+  Whether the messages waiting behind the write in progress exceed the limits
+  */
+  bool over_limits() const
+  {
+    return write_msgs_.size() - batch_size_ > 1
+      && (write_msgs_.size() - batch_size_ > limits_.max_messages || queued_bytes_ > limits_.max_bytes);
+  }
+  /*!
+  Remove the waiting message at index i (never one being written)
+  */
+  void drop(std::size_t i)
+  {
+    queued_bytes_ -= write_msgs_[i]->length();
+    write_msgs_.erase(write_msgs_.begin() + i);
+  }
+  /*!
+  Apply the policy if the message just queued overflowed the queue.
+  Return false if the connection was closed
+  */
+  bool enforce_limits()
+  {
+    if (!over_limits())
+      return true;
+    switch (limits_.policy)
+    {
+      case Write_limits::COALESCE_IMAGE:
+      {
+        //The newest image supersedes the queued ones, the other messages are kept
+        if (write_msgs_.back()->opcode() == Message::IMAGE)
         {
-          if (!ec)
-          {
-			std::string s = std::string(read_msg_.body());
-			img->deserialize(s);
-            do_read_header();
-          }
-          else
+          for (std::size_t i = write_msgs_.size() - 1; i-- > batch_size_;)
           {
-            room_.leave(shared_from_this());
+            if (write_msgs_[i]->opcode() == Message::IMAGE)
+            {
+              drop(i);
+              ++stats_.coalesced;
+            }
           }
-        });
+        }
+      } //fall through, drop the oldest if the images were not enough
+      case Write_limits::DROP_OLDEST:
+      {
+        while (over_limits())
+        {
+          drop(batch_size_);
+          ++stats_.dropped;
+        }
+      }break;
+
+      case Write_limits::DISCONNECT:
+      {
+        ++stats_.disconnected;
+        std::cout << "Client " << ID << " is too slow, disconnected" << std::endl;
+        close();
+        return false;
+      }
+    }
+    return true;
+  }
+  /*!
+  Close the connection and leave the room, the pending handlers fail and stop.
+  The messages being written are still referenced by the write in progress, only the waiting ones are dropped here,
+  the write handler releases the others when it fails
+  */
+  void close()
+  {
+    closed_ = true;
+    boost::system::error_code ec;
+    socket_.close(ec);
+    write_msgs_.erase(write_msgs_.begin() + batch_size_, write_msgs_.end());
+    queued_bytes_ = 0;
+    room_.leave(shared_from_this());
   }
   /*!
   Write to the socket, then ask to write again if some writes are needed to be done (due to asychronous design)
+  Every queued message fitting in max_batch_bytes_ is gathered into a single write, so a burst costs one write, not one per message
   */
   void do_write()
   {
     auto self(shared_from_this());
-    boost::asio::async_write(socket_,
-        boost::asio::buffer(write_msgs_.front().data(),
-          write_msgs_.front().length()),
-        [this, self](boost::system::error_code ec, std::size_t /*length*/)
+    std::size_t bytes = 0;
+    write_buffers_.clear();
+    for (batch_size_ = 0; batch_size_ < write_msgs_.size(); ++batch_size_)
+    {
+      const Message_ptr& msg = write_msgs_[batch_size_];
+      if (batch_size_ && bytes + msg->length() > limits_.max_batch_bytes)
+        break;
+      write_buffers_.push_back(boost::asio::buffer(msg->data(), msg->length()));
+      bytes += msg->length();
+    }
+    queued_bytes_ -= bytes;
+    boost::asio::async_write(socket_, write_buffers_,
+        strand_.wrap([this, self](boost::system::error_code ec, std::size_t /*length*/)
         {
-          if (!ec)
+          write_msgs_.erase(write_msgs_.begin(), write_msgs_.begin() + batch_size_);
+          batch_size_ = 0;
+          if (!ec && !closed_)
           {
-            write_msgs_.pop_front();
             if (!write_msgs_.empty())
             {
               do_write();
@@ -193,15 +398,23 @@ private:
           }
           else
           {
+            write_msgs_.clear();
             room_.leave(shared_from_this());
           }
-        });
+        }));
   }
 
   tcp::socket socket_; /*!< boost:asio TCP socket */
+  boost::asio::io_service::strand strand_; /*!< Strand through which every handler of this client runs */
   Room& room_; /*!< The room in which the client is connected */
-  Message read_msg_; /*!< The message being read */
+  Message_reader reader_; /*!< Buffer of the bytes read from the socket, reused from one read to the next */
   Message_queue write_msgs_; /*!< A list of message de send (due to asynchronous design) */
+  std::vector<boost::asio::const_buffer> write_buffers_; /*!< Buffers of the messages being written, reused from one write to the next */
+  const Write_limits& limits_; /*!< Limits of the write queue, shared by every client */
+  Write_stats& stats_; /*!< Counters of the limits hit, shared by every client */
+  std::size_t batch_size_; /*!< Number of messages, at the front of the queue, being written */
+  std::size_t queued_bytes_; /*!< Bytes of the messages waiting behind the ones being written */
+  bool closed_; /*!< Whether the connection was closed for being too slow */
 };
 
 //----------------------------------------------------------------------
@@ -212,26 +425,28 @@ Class that handle the input and output of the server (basically reading and writ
 class ServerIO
 {
 public:
+  /*!
+  \param limits Limits of the write queue of every client
+  */
   ServerIO(boost::asio::io_service& io_service,
-      const tcp::endpoint& endpoint)
-    : acceptor_(io_service, endpoint),
-	socket_(io_service), ID(0)
+      const tcp::endpoint& endpoint,
+      const Write_limits& limits = Write_limits())
+    : io_service_(io_service), acceptor_(io_service, endpoint),
+	socket_(io_service), ID(0), limits_(limits), last_request_(0)
   {
     do_accept();
   }
   /*!
-  Create a "GET" message and send it to all the client connected to the room
+  Create a GET message with a new request ID and send it to all the client connected to the room, the message is encoded once and shared
   */
   bool do_send()
   {
-	  if (room_.participants().size())
+	  Room::Participants_ptr participants = room_.participants();
+	  if (participants->size())
 	  {
-		  Message msg;
-		  msg.body_length(std::strlen("GET"));
-		  std::memcpy(msg.body(), "GET", msg.body_length());
-		  msg.encode_header();
-		  for (auto participant : room_.participants())
-			  participant->deliver(msg);
+		  Message_ptr msg = std::make_shared<Message>(Message::GET, 0, ++last_request_);
+		  for (auto& entry : *participants)
+			  entry.second->deliver(msg);
 		  return true;
 	  }
 	  else
@@ -245,18 +460,24 @@ public:
   */
   bool do_send_back()
   {
-	  if (room_.participants().size())
+	  Room::Participants_ptr participants = room_.participants();
+	  if (participants->size())
 	  {
-		  for (auto participant : room_.participants())
+		  for (auto& entry : *participants)
 		  {
+			  const ClientConnection_ptr& participant = entry.second;
 			  //get this participant image to string then send it
-			  Message msg;
+			  Encoding encoding = participant->encoding;
+			  std::shared_ptr<Message> msg = std::make_shared<Message>(Message::IMAGE, encoding == BINARY ? Message::BINARY_BODY : 0);
 			  std::string s;
-			  participant->img->serialize(s);
-			  msg.body_length(s.length());
-			  std::memcpy(msg.body(), s.c_str(), msg.body_length());
-			  msg.encode_header();
-			  participant->deliver(msg);
+			  {
+				  std::lock_guard<std::mutex> lock(participant->img_mutex);
+				  participant->img->serialize(s, encoding);
+			  }
+			  if (msg->set_body(s))
+				  participant->deliver(msg);
+			  else
+				  std::cout << "Image of client " << participant->ID << " is too large to be sent" << std::endl;
 		  }
 		  return true;
 	  }
@@ -271,12 +492,17 @@ public:
   */
   bool do_print()
   {
-	  if (room_.participants().size())
+	  Room::Participants_ptr participants = room_.participants();
+	  if (participants->size())
 	  {
 		  std::cout << "Client ID : " << std::endl;
-		  for (auto participant : room_.participants())
+		  for (auto& entry : *participants)
 		  {
-			   std::cout << participant->ID << std::endl;
+			   const ClientConnection_ptr& participant = entry.second;
+			   std::cout << participant->ID;
+			   if (last_request_ && participant->answered_request == last_request_)
+				   std::cout << " (image received)";
+			   std::cout << std::endl;
 		  }
 		  return true;
 	  }
@@ -287,17 +513,33 @@ public:
 	  }
   }
   /*!
-  Give the image associated the the Client ID the annotation contained in msg
+  Give the image associated the the Client ID the annotation contained in msg, and send it to the client
+  Return false if there is no such client
   */
-  void do_annotation(int ID, std::string msg)
+  bool do_annotation(int ID, std::string msg)
   {
-	  for (auto participant : room_.participants())
+	  ClientConnection_ptr participant = room_.find(ID);
+	  if (!participant)
+		  return false;
 	  {
-		  if (participant->ID == ID)
-		  {
-			  participant->img->annotate(msg);
-		  }
+		  std::lock_guard<std::mutex> lock(participant->img_mutex);
+		  participant->img->annotate(msg);
 	  }
+	  std::shared_ptr<Message> annotation = std::make_shared<Message>(Message::ANNOTATE);
+	  if (annotation->set_body(msg))
+		  participant->deliver(annotation);
+	  return true;
+  }
+  /*!
+  Print the limits of the write queues and how often they were hit
+  */
+  void do_print_queues()
+  {
+	  static const char* policies[] = { "drop oldest", "coalesce images", "disconnect" };
+	  std::cout << "Write queue limits : " << limits_.max_messages << " messages, " << limits_.max_bytes << " bytes, policy : " << policies[limits_.policy] << std::endl;
+	  std::cout << "Dropped messages : " << write_stats_.dropped << std::endl;
+	  std::cout << "Coalesced images : " << write_stats_.coalesced << std::endl;
+	  std::cout << "Disconnected clients : " << write_stats_.disconnected << std::endl;
   }
   /*!
   Getter for the room
@@ -318,7 +560,7 @@ private:
         {
           if (!ec)
           {
-            std::make_shared<Client>(std::move(socket_), room_, ID++)->start();
+            std::make_shared<Client>(std::move(socket_), io_service_, room_, ID++, limits_, write_stats_)->start();
 
 			std::cout << "Nouvelle connection " << ID << std::endl;
           }
@@ -327,10 +569,14 @@ private:
         });
   }
 
+  boost::asio::io_service& io_service_; /*!< boost::asio io_service shared by every client */
   tcp::acceptor acceptor_; /*!< boost::asio acceptor (the core object of a server) that can accept connections */
   tcp::socket socket_; /*!< boost::asio TCP Socket */
   Room room_; /*!< A room allocated to the server */
   int ID; /*!< An ID which will be incremented at each connections */
+  Write_limits limits_; /*!< Limits of the write queue, given to every client */
+  Write_stats write_stats_; /*!< Counters of the limits hit by every client */
+  uint32_t last_request_; /*!< Request ID of the last GET sent */
 };
 
 //----------------------------------------------------------------------
@@ -341,7 +587,7 @@ Class that handle the Server's input commands, basically polling commands from t
 class Server
 {
 public:
-	enum Commands { DISPLAY = 0, SEND, GET, PRINT, ANNOTATE, STATS, PATCHWORK, HELP, QUIT, UNKNOWN }; /*!< Enums of available commands */
+	enum Commands { DISPLAY = 0, SEND, GET, PRINT, ANNOTATE, STATS, PATCHWORK, EXPORT, PICK, QUEUES, HELP, QUIT, UNKNOWN }; /*!< Enums of available commands */
 	static const std::vector<std::string> cmds; /*!< A static container of strings defining the command string assiciaited to its Commands enum value  */
 	/*!
 	Static function to print available commands keywords
@@ -369,18 +615,77 @@ public:
 	/*!
 	Class that creates the Server and poll user input to execute commands
 	\param service boost::asio io_service
+	\param nb_threads Number of threads running the io_service, clients are handled in parallel by them
+	\param limits Limits of the write queue of every client
+	\param max_fps Frame cap of the windows, 0 for none
 	*/
-	Server(boost::asio::io_service& service) : io_service(service)
+	Server(boost::asio::io_service& service, std::size_t nb_threads = 1, const Write_limits& limits = Write_limits(), int max_fps = 60)
+		: max_fps(max_fps), io_service(service)
 	{
 		//Init socket
 		tcp::endpoint endpoint(tcp::v4(), 8080);
-		s = new ServerIO(io_service, std::move(endpoint));
-		t = new std::thread([&](){ io_service.run(); });
-		SDL_Init(SDL_INIT_VIDEO);
+		s = new ServerIO(io_service, std::move(endpoint), limits);
+		for (std::size_t i = 0; i < std::max<std::size_t>(nb_threads, 1); ++i)
+			threads.emplace_back([&](){ io_service.run(); });
+		video_ready = false;
 		start_polling();
 	};
 
 private:
+	/*!
+	Initialize the SDL video the first time a window is needed, so a server nobody looks at runs without a display
+	*/
+	void init_video()
+	{
+		if (!video_ready)
+		{
+			SDL_Init(SDL_INIT_VIDEO);
+			video_ready = true;
+		}
+	}
+	/*!
+	Build an image made of all the participants images side by side, to be deleted by the caller after undo_patchwork
+	(the participants images are left to them).
+	The participants images are moved, undo_patchwork puts them back : both only compose a pending translation (see Image::flatten),
+	whatever the number of shapes.
+	*/
+	Image* make_patchwork(const Room::Participants_ptr& participants)
+	{
+		Image* Im = new Image();
+		float last_x = 0;
+		float origin_x = 0;
+		for (auto& entry : *participants)
+		{
+			const ClientConnection_ptr& participant = entry.second;
+			std::lock_guard<std::mutex> lock(participant->img_mutex);
+			BoundingBox bb = participant->img->bounding_box();
+			float w = bb.empty() ? 0.f : bb.x_max - bb.x_min;
+			if (last_x == 0)
+			{
+				Im->add_component(participant->img);
+				last_x = last_x + (w / 2);
+			}
+			else
+			{
+				origin_x = last_x + (w / 2);
+				participant->img->origin(Vec2(origin_x, 0));
+				Im->add_component(participant->img);
+				last_x = last_x + w;							
+			}						
+		}
+		return Im;
+	}
+	/*!
+	Put back the participants images moved by make_patchwork
+	*/
+	void undo_patchwork(const Room::Participants_ptr& participants)
+	{
+		for (auto& entry : *participants)
+		{
+			std::lock_guard<std::mutex> lock(entry.second->img_mutex);
+			entry.second->img->origin(Vec2(0, 0));
+		}
+	}
 	/*!
 	Function thats polls user inputs and call the associated functions
 	*/
@@ -422,28 +727,23 @@ private:
 							std::cout << std::endl << "Problem : " << e.what() << std::endl;
 							break;
 						}
-						bool found_ID = false;
-						for (auto participant : s->room().participants())
+						ClientConnection_ptr participant = s->room().find(ID);
+						if (participant)
 						{
-							if (participant->ID == ID)
+							init_video();
+							//Drawn again only when the image changed, each frame is otherwise a single blit
+							Viewer viewer("Client " + std::to_string(ID), max_fps);
+							viewer.run([&](Canvas& canvas)
 							{
-								SDL_CreateWindowAndRenderer(800, 600, 0, &window, &renderer);
-								while (1) {
-									SDL_PollEvent(&event);
-									if (event.type == SDL_QUIT) {
-										break;
-									}
-									SDL_SetRenderDrawColor(renderer, 255, 255, 255, 0x00);
-									SDL_RenderClear(renderer);
-									participant->img->display(renderer);
-									SDL_RenderPresent(renderer);
-								}
-								SDL_DestroyWindow(window);
-								found_ID = true;
-								break;
-							}
+								std::lock_guard<std::mutex> lock(participant->img_mutex);
+								participant->img->display_cached(canvas);
+							}, [&]()
+							{
+								std::lock_guard<std::mutex> lock(participant->img_mutex);
+								return participant->img->revision();
+							});
 						}
-						if (!found_ID)
+						else
 						{
 							std::cout << "ID : " << ID << " not found" << std::endl;
 						}
@@ -464,43 +764,131 @@ private:
 
 				case Commands::PATCHWORK:
 				{
-					Image* Im = new Image();
-					int last_x = 0;
-					int origin_x = 0;
-					for (auto participant : s->room().participants())
+					Room::Participants_ptr participants = s->room().participants();
+					std::unique_ptr<Image> Im(make_patchwork(participants));
+					init_video();
 					{
-						if (last_x == 0)
+						//The patchwork is only drawn again when one of the images changed
+						Viewer viewer("Patchwork", max_fps);
+						viewer.run([&](Canvas& canvas)
 						{
-							Im->add_component(participant->img);
-							BoundingBox bb = participant->img->bounding_box();
-							int w = bb.x_max - bb.x_min;
-							last_x = last_x + (w / 2);
-						}
-						else
+							//Hold every image while drawing the frame, the I/O threads wait at most one frame
+							std::vector<std::unique_lock<std::mutex>> locks;
+							for (auto& entry : *participants)
+								locks.emplace_back(entry.second->img_mutex);
+							Im->display_cached(canvas);
+						}, [&]()
 						{
-							BoundingBox bb = participant->img->bounding_box();
-							int w = bb.x_max - bb.x_min;
-							origin_x = last_x + (w / 2);
-							participant->img->origin(Vec2(origin_x, 0));
-							Im->add_component(participant->img);
-							last_x = last_x + w;							
-						}						
+							std::vector<std::unique_lock<std::mutex>> locks;
+							for (auto& entry : *participants)
+								locks.emplace_back(entry.second->img_mutex);
+							return Im->revision();
+						});
 					}
-					SDL_CreateWindowAndRenderer(800, 600, 0, &window, &renderer);
-					while (1) {
-						SDL_PollEvent(&event);
-						if (event.type == SDL_QUIT) {
+					undo_patchwork(participants);
+				}break;
+
+				case Commands::EXPORT:
+				{
+					//Render a client image, or the patchwork, in memory and save it, no display needed
+					if (s->do_print())
+					{
+						int ID;
+						std::string path;
+						std::cout << "Choose an ID from the list, or -1 for the patchwork :";
+						try
+						{
+							std::cin >> ID;
+							if (std::cin.fail())
+							{
+								std::cin.clear();
+								throw std::domain_error("Bad input");
+							}
+						}
+						catch (std::exception& e)
+						{
+							std::cout << std::endl << "Problem : " << e.what() << std::endl;
 							break;
 						}
-						SDL_SetRenderDrawColor(renderer, 255, 255, 255, 0x00);
-						SDL_RenderClear(renderer);
-						Im->display(renderer);
-						SDL_RenderPresent(renderer);
+						std::cout << "Enter the file name (.png or .ppm) :";
+						std::getline(std::cin, path);
+						std::getline(std::cin, path);
+						Framebuffer framebuffer(800, 600);
+						framebuffer.clear(Color(255, 255, 255));
+						if (ID == -1)
+						{
+							Room::Participants_ptr participants = s->room().participants();
+							std::unique_ptr<Image> Im(make_patchwork(participants));
+							{
+								std::vector<std::unique_lock<std::mutex>> locks;
+								for (auto& entry : *participants)
+									locks.emplace_back(entry.second->img_mutex);
+								Im->display_parallel(framebuffer, std::thread::hardware_concurrency());
+							}
+							undo_patchwork(participants);
+						}
+						else
+						{
+							ClientConnection_ptr participant = s->room().find(ID);
+							if (!participant)
+							{
+								std::cout << "ID : " << ID << " not found" << std::endl;
+								break;
+							}
+							std::lock_guard<std::mutex> lock(participant->img_mutex);
+							participant->img->display_parallel(framebuffer, std::thread::hardware_concurrency());
+						}
+						const Canvas::Counters& counters = framebuffer.counters();
+						std::cout << counters.drawn << " shapes drawn, " << counters.culled << " culled, " << counters.collapsed << " collapsed to a pixel" << std::endl;
+						bool png = path.size() >= 4 && path.compare(path.size() - 4, 4, ".png") == 0;
+						if (png ? framebuffer.write_png(path) : framebuffer.write_ppm(path))
+							std::cout << "Image saved to " << path << std::endl;
+						else
+							std::cout << "Can't write " << path << std::endl;
 					}
-					SDL_DestroyWindow(window);
-					for (auto participant : s->room().participants())
+				}break;
+
+				case Commands::PICK:
+				{
+					//Hit test a client image : which shape is at this point
+					if (s->do_print())
 					{
-						participant->img->origin(Vec2(0, 0));
+						int ID;
+						float x, y;
+						std::cout << "Choose an ID from the list :";
+						try
+						{
+							std::cin >> ID;
+							if (std::cin.fail())
+							{
+								std::cin.clear();
+								throw std::domain_error("Bad input");
+							}
+							std::cout << "Enter the point (x y) :";
+							std::cin >> x >> y;
+							if (std::cin.fail())
+							{
+								std::cin.clear();
+								throw std::domain_error("Bad input");
+							}
+						}
+						catch (std::exception& e)
+						{
+							std::cout << std::endl << "Problem : " << e.what() << std::endl;
+							break;
+						}
+						ClientConnection_ptr participant = s->room().find(ID);
+						if (!participant)
+						{
+							std::cout << "ID : " << ID << " not found" << std::endl;
+							break;
+						}
+						std::lock_guard<std::mutex> lock(participant->img_mutex);
+						Shape* shape = participant->img->component_at(Vec2(x, y));
+						if (shape)
+							std::cout << "Shape " << shape->id() << " : " << *shape;
+						else
+							std::cout << "No shape at " << Vec2(x, y) << std::endl;
 					}
 				}break;
 
@@ -527,21 +915,17 @@ private:
 							std::cout << std::endl << "Problem : " << e.what() << std::endl;
 							break;
 						}
-						bool found_ID = false;
-						for (auto participant : s->room().participants())
+						if (s->room().find(ID))
 						{
-							if (participant->ID == ID)
-							{
-								std::cout << "Enter your annotation :";
-								std::getline(std::cin, annotation);
-								std::getline(std::cin, annotation);
-								s->do_annotation(ID, annotation);
-								found_ID = true;
+							std::cout << "Enter your annotation :";
+							std::getline(std::cin, annotation);
+							std::getline(std::cin, annotation);
+							if (s->do_annotation(ID, annotation))
 								std::cout << "Annotation entered" << std::endl;
-								break;
-							}
+							else
+								std::cout << "ID : " << ID << " left before the annotation was entered" << std::endl;
 						}
-						if (!found_ID)
+						else
 						{
 							std::cout << "ID : " << ID << " not found" << std::endl;
 						}
@@ -554,22 +938,12 @@ private:
 					// zero-initialis\E9, ont as pas besoin de la faire nous m\EAme
 					std::map< Shape::Derivedtype, int > shapes_count;
 					std::map< Color, int > color_count;
-					for (auto participant : s->room().participants())
+					Room::Participants_ptr participants = s->room().participants();
+					for (auto& entry : *participants)
 					{
-						for (auto shape : participant->img->components())
-						{
-							if (shape->type() == Shape::IMAGE)
-							{
-								Image * im = static_cast<Image*>(shape);
-								for (auto imageShape : im->components())
-								{
-									shapes_count[imageShape->type()]++;
-									color_count[imageShape->color()]++;
-								}
-							}
-							shapes_count[shape->type()]++;
-							color_count[shape->color()]++;
-						}
+						const ClientConnection_ptr& participant = entry.second;
+						std::lock_guard<std::mutex> lock(participant->img_mutex);
+						participant->img->tally(shapes_count, color_count);
 					}
 
 					for (auto key_value : shapes_count)
@@ -601,6 +975,11 @@ private:
 					}
 				}break;
 
+				case Commands::QUEUES:
+				{
+					s->do_print_queues();
+				}break;
+
 				case Commands::PRINT:
 				{
 					s->do_print();
@@ -633,30 +1012,51 @@ private:
 
 		}
 		io_service.stop();
-		t->join();
+		for (auto& t : threads)
+			t.join();
 	}
 
 	ServerIO* s; /*!< A list of message de send (due to asynchronous design) */
-	SDL_Event event; /*!< SDL Event so we can know when to close the window */
-	SDL_Window *window; /*!< SDL window to display to */
-	SDL_Renderer *renderer; /*!< SDL renderer to draw components to */
+	bool video_ready; /*!< Whether the SDL video was initialized */
+	int max_fps; /*!< Frame cap of the windows, 0 for none */
 	boost::asio::io_service& io_service;  /*!< boost::asio io_service */
 	tcp::resolver* resolver; /*!< boost::asio TCP resolver */
-	std::thread* t;  /*!< Thread polling Input/Output event from io_service */
+	std::vector<std::thread> threads;  /*!< Pool of threads polling Input/Output event from io_service */
 };
-const std::vector<std::string> Server::cmds = { "display", "send", "get", "print", "annotate", "stats", "patchwork", "help" , "quit"};
+const std::vector<std::string> Server::cmds = { "display", "send", "get", "print", "annotate", "stats", "patchwork", "export", "pick", "queues", "help" , "quit"};
 
 
 #if _WIN32
 int _tmain(int argc, _TCHAR* argv[])
 #else
-int main()
+int main(int argc, char* argv[])
 #endif
 {
+  //Arguments, all optional : number of I/O threads (one per core by default),
+  // then the write queue limits of each client : max messages, max bytes, policy (0 drop oldest, 1 coalesce images, 2 disconnect),
+  // then the frame cap of the windows (60 by default, 0 for none)
+  std::vector<long> args;
+  for (int i = 1; i < argc; ++i)
+  {
+#if _WIN32
+	args.push_back(_ttol(argv[i]));
+#else
+	args.push_back(atol(argv[i]));
+#endif
+  }
+  std::size_t nb_threads = args.size() > 0 && args[0] > 0 ? args[0] : std::thread::hardware_concurrency();
+  Write_limits limits;
+  if (args.size() > 1 && args[1] > 0)
+	limits.max_messages = args[1];
+  if (args.size() > 2 && args[2] > 0)
+	limits.max_bytes = args[2];
+  if (args.size() > 3 && args[3] >= Write_limits::DROP_OLDEST && args[3] <= Write_limits::DISCONNECT)
+	limits.policy = static_cast<Write_limits::Policy>(args[3]);
+  int max_fps = args.size() > 4 && args[4] >= 0 ? (int)args[4] : 60;
   try
   {
 	boost::asio::io_service io_service;
-	Server s(io_service);
+	Server s(io_service, nb_threads, limits, max_fps);
   }
   catch (std::exception& e)
   {
@@ -0,0 +1,393 @@
+#pragma once
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "Maths.h"
+#include "Raster.h"
+#include "SDL2/SDL.h"
+
+/*! \file Canvas.h
+\brief Header files containing the render targets the shapes are displayed to.
+
+Gives access to the Canvas interface and its two implementations : SDLCanvas drawing on a SDL renderer,
+and Framebuffer drawing in memory, without any window, which can be saved as a PPM or PNG file.
+*/
+
+namespace Patchwork
+{
+	class Framebuffer;
+
+	/*!
+	A render target. Shapes are drawn as spans (see Raster.h) and lines, with the current color.
+	*/
+	class Canvas : public SpanSink
+	{
+	public:
+		/*!
+		What became of the shapes given to the canvas by Image::display, counted until reset
+		*/
+		struct Counters
+		{
+			Counters() : drawn(0), culled(0), collapsed(0) {}
+			Counters& operator+=(const Counters& other)
+			{
+				drawn += other.drawn;
+				culled += other.culled;
+				collapsed += other.collapsed;
+				return *this;
+			}
+			uint64_t drawn; /*!< Shapes drawn in full */
+			uint64_t culled; /*!< Shapes or nested images skipped, outside of the target */
+			uint64_t collapsed; /*!< Shapes or nested images smaller than a pixel, drawn as a single pixel */
+		};
+		virtual ~Canvas() {}
+		/*!
+		Width of the target in pixels
+		*/
+		virtual int width() const = 0;
+		/*!
+		Height of the target in pixels
+		*/
+		virtual int height() const = 0;
+		/*!
+		Set the color of the next spans and lines
+		*/
+		virtual void set_color(const Color& color) = 0;
+		/*!
+		Fill the whole target with a color
+		*/
+		virtual void clear(const Color& color) = 0;
+		/*!
+		Draw a line between two pixels, both included
+		*/
+		virtual void line(int x0, int y0, int x1, int y1) = 0;
+		/*!
+		Copy the pixels of a framebuffer of the same size over the whole target
+		*/
+		virtual void blit(const Framebuffer& source) = 0;
+		/*!
+		Draw everything still pending
+		*/
+		virtual void flush() {}
+		/*!
+		Getter of the counters, which can be reset by assigning Counters()
+		*/
+		Counters& counters() { return m_counters; }
+	protected:
+		Counters m_counters; /*!< What became of the shapes drawn */
+	};
+
+	/*!
+	Canvas drawing on a SDL renderer.
+	Spans are batched into rectangles and drawn with a single SDL_RenderFillRects when the color changes or when flushed (or destroyed).
+	*/
+	class SDLCanvas : public Canvas
+	{
+	public:
+		SDLCanvas(SDL_Renderer* renderer) : m_renderer(renderer), m_width(0), m_height(0), m_texture(nullptr)
+		{
+			SDL_GetRendererOutputSize(renderer, &m_width, &m_height);
+		}
+		~SDLCanvas()
+		{
+			flush();
+			if (m_texture)
+				SDL_DestroyTexture(m_texture);
+		}
+		SDLCanvas(const SDLCanvas&) = delete;
+		SDLCanvas& operator=(const SDLCanvas&) = delete;
+
+		int width() const { return m_width; }
+		int height() const { return m_height; }
+		void set_color(const Color& color)
+		{
+			flush();
+			SDL_SetRenderDrawColor(m_renderer, color.r, color.g, color.b, 0x00);
+		}
+		void clear(const Color& color)
+		{
+			m_rects.clear();
+			SDL_SetRenderDrawColor(m_renderer, color.r, color.g, color.b, 0x00);
+			SDL_RenderClear(m_renderer);
+		}
+		void span(int y, int x0, int x1)
+		{
+			SDL_Rect rect = { x0, y, x1 - x0, 1 };
+			m_rects.push_back(rect);
+		}
+		void line(int x0, int y0, int x1, int y1)
+		{
+			flush();
+			SDL_RenderDrawLine(m_renderer, x0, y0, x1, y1);
+		}
+		/*!
+		Upload the pixels to a streaming texture, kept as long as the canvas, and copy it over the renderer
+		*/
+		void blit(const Framebuffer& source);
+		void flush()
+		{
+			if (!m_rects.empty())
+			{
+				SDL_RenderFillRects(m_renderer, m_rects.data(), (int)m_rects.size());
+				m_rects.clear();
+			}
+		}
+	private:
+		SDL_Renderer* m_renderer; /*!< Renderer to draw to */
+		int m_width; /*!< Output width of the renderer */
+		int m_height; /*!< Output height of the renderer */
+		std::vector<SDL_Rect> m_rects; /*!< Spans waiting to be drawn */
+		SDL_Texture* m_texture; /*!< Texture the framebuffers are blitted through, created on the first blit */
+	};
+
+	/*!
+	Canvas drawing in an in-memory RGBA buffer, no display nor SDL video needed.
+	Everything drawn outside of the clip rectangle (the whole buffer by default) is clipped.
+	*/
+	class Framebuffer : public Canvas
+	{
+	public:
+		Framebuffer(int width, int height)
+			: m_width(std::max(width, 0)), m_height(std::max(height, 0)), m_pixels(4 * m_width * m_height, 255)
+		{
+			m_data = m_pixels.data();
+			m_clip[0] = 0;
+			m_clip[1] = 0;
+			m_clip[2] = m_width;
+			m_clip[3] = m_height;
+			set_color(Color());
+		}
+		/*!
+		Create a view drawing into the pixels of parent, clipped to the rectangle (x0, y0) (x1, y1) (excluded) inside the parent's clip rectangle.
+		The view has the size of its parent, so shapes are placed the same, and its own color : views of disjoint rectangles can be drawn by different threads.
+		The parent must outlive the view.
+		*/
+		Framebuffer(Framebuffer& parent, int x0, int y0, int x1, int y1)
+			: m_width(parent.m_width), m_height(parent.m_height), m_data(parent.m_data)
+		{
+			m_clip[0] = std::max(x0, parent.m_clip[0]);
+			m_clip[1] = std::max(y0, parent.m_clip[1]);
+			m_clip[2] = std::max(m_clip[0], std::min(x1, parent.m_clip[2]));
+			m_clip[3] = std::max(m_clip[1], std::min(y1, parent.m_clip[3]));
+			set_color(Color());
+		}
+		Framebuffer(const Framebuffer&) = delete;
+		Framebuffer& operator=(const Framebuffer&) = delete;
+
+		int width() const { return m_width; }
+		int height() const { return m_height; }
+		void set_color(const Color& color)
+		{
+			m_color[0] = (unsigned char)std::min(std::max(color.r, 0), 255);
+			m_color[1] = (unsigned char)std::min(std::max(color.g, 0), 255);
+			m_color[2] = (unsigned char)std::min(std::max(color.b, 0), 255);
+			m_color[3] = 255;
+		}
+		/*!
+		Fill the clip rectangle with a color
+		*/
+		void clear(const Color& color)
+		{
+			set_color(color);
+			for (int y = m_clip[1]; y < m_clip[3]; ++y)
+				fill(y, m_clip[0], m_clip[2]);
+		}
+		void span(int y, int x0, int x1)
+		{
+			if (y < m_clip[1] || y >= m_clip[3])
+				return;
+			fill(y, std::max(x0, m_clip[0]), std::min(x1, m_clip[2]));
+		}
+		/*!
+		Bresenham line, both ends included as SDL_RenderDrawLine does
+		*/
+		void line(int x0, int y0, int x1, int y1)
+		{
+			int dx = std::abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
+			int dy = -std::abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
+			int err = dx + dy;
+			while (true)
+			{
+				if (x0 >= m_clip[0] && x0 < m_clip[2] && y0 >= m_clip[1] && y0 < m_clip[3])
+					fill(y0, x0, x0 + 1);
+				if (x0 == x1 && y0 == y1)
+					break;
+				int e2 = 2 * err;
+				if (e2 >= dy)
+				{
+					err += dy;
+					x0 += sx;
+				}
+				if (e2 <= dx)
+				{
+					err += dx;
+					y0 += sy;
+				}
+			}
+		}
+		/*!
+		Copy the pixels of a framebuffer of the same size, inside the clip rectangle
+		*/
+		void blit(const Framebuffer& source)
+		{
+			if (source.m_width != m_width || source.m_height != m_height)
+				return;
+			for (int y = m_clip[1]; y < m_clip[3]; ++y)
+			{
+				std::size_t offset = 4 * ((std::size_t)y * m_width + m_clip[0]);
+				memcpy(m_data + offset, source.m_data + offset, 4 * (m_clip[2] - m_clip[0]));
+			}
+		}
+		/*!
+		Color of a pixel, which must be in the buffer
+		*/
+		Color pixel(int x, int y) const
+		{
+			const unsigned char* p = m_data + 4 * (y * m_width + x);
+			return Color(p[0], p[1], p[2]);
+		}
+		/*!
+		The RGBA bytes of the buffer, row by row from the top
+		*/
+		const unsigned char* data() const { return m_data; }
+		/*!
+		Save the buffer as a binary PPM file, return false if it can't be written
+		*/
+		bool write_ppm(const std::string& path) const
+		{
+			std::ofstream out(path.c_str(), std::ios::binary);
+			out << "P6\n" << m_width << " " << m_height << "\n255\n";
+			for (std::size_t i = 0; i < 4 * (std::size_t)m_width * m_height; i += 4)
+				out.write((const char*)m_data + i, 3);
+			return (bool)out;
+		}
+		/*!
+		Save the buffer as a RGBA PNG file, return false if it can't be written.
+		The image data is stored without compression, which every PNG reader accepts and costs nothing to produce.
+		*/
+		bool write_png(const std::string& path) const
+		{
+			std::string raw;
+			raw.reserve((4 * m_width + 1) * m_height);
+			for (int y = 0; y < m_height; ++y)
+			{
+				raw.push_back(0); //no filter
+				raw.append((const char*)m_data + 4 * y * m_width, 4 * m_width);
+			}
+
+			//zlib stream made of stored deflate blocks
+			std::string zlib("\x78\x01", 2);
+			std::size_t pos = 0;
+			do
+			{
+				std::size_t len = std::min<std::size_t>(raw.size() - pos, 65535);
+				zlib.push_back(pos + len == raw.size() ? 1 : 0);
+				zlib.push_back((char)(len & 0xff));
+				zlib.push_back((char)(len >> 8));
+				zlib.push_back((char)(~len & 0xff));
+				zlib.push_back((char)((~len >> 8) & 0xff));
+				zlib.append(raw, pos, len);
+				pos += len;
+			} while (pos < raw.size());
+			append_u32(zlib, adler32(raw));
+
+			std::string header;
+			append_u32(header, m_width);
+			append_u32(header, m_height);
+			header.append("\x08\x06\x00\x00\x00", 5); //8 bits RGBA, no interlace
+
+			std::ofstream out(path.c_str(), std::ios::binary);
+			out.write("\x89PNG\r\n\x1a\n", 8);
+			write_chunk(out, "IHDR", header);
+			write_chunk(out, "IDAT", zlib);
+			write_chunk(out, "IEND", "");
+			return (bool)out;
+		}
+	private:
+		/*!
+		Fill the pixels x0 to x1 (excluded) of the row y, already clipped
+		*/
+		void fill(int y, int x0, int x1)
+		{
+			unsigned char* p = m_data + 4 * (y * m_width + x0);
+			for (int x = x0; x < x1; ++x, p += 4)
+				memcpy(p, m_color, 4);
+		}
+		static void append_u32(std::string& out, uint32_t v)
+		{
+			out.push_back((char)(v >> 24));
+			out.push_back((char)(v >> 16));
+			out.push_back((char)(v >> 8));
+			out.push_back((char)v);
+		}
+		static uint32_t adler32(const std::string& data)
+		{
+			uint32_t a = 1, b = 0;
+			for (unsigned char c : data)
+			{
+				a = (a + c) % 65521;
+				b = (b + a) % 65521;
+			}
+			return (b << 16) | a;
+		}
+		static uint32_t crc32(const std::string& data)
+		{
+			static const std::vector<uint32_t> table = []()
+			{
+				std::vector<uint32_t> t(256);
+				for (uint32_t n = 0; n < 256; ++n)
+				{
+					uint32_t c = n;
+					for (int k = 0; k < 8; ++k)
+						c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+					t[n] = c;
+				}
+				return t;
+			}();
+			uint32_t crc = 0xffffffffu;
+			for (unsigned char c : data)
+				crc = table[(crc ^ c) & 0xff] ^ (crc >> 8);
+			return crc ^ 0xffffffffu;
+		}
+		static void write_chunk(std::ofstream& out, const char* type, const std::string& data)
+		{
+			std::string chunk(type);
+			chunk += data;
+			std::string length, crc;
+			append_u32(length, (uint32_t)data.size());
+			append_u32(crc, crc32(chunk));
+			out << length << chunk << crc;
+		}
+
+		int m_width; /*!< Width in pixels */
+		int m_height; /*!< Height in pixels */
+		std::vector<unsigned char> m_pixels; /*!< RGBA pixels, row by row from the top, white at creation (empty for a view) */
+		unsigned char* m_data; /*!< The pixels drawn to, its own or the parent's for a view */
+		int m_clip[4]; /*!< Clip rectangle x0, y0, x1, y1 (excluded) */
+		unsigned char m_color[4]; /*!< Current RGBA color */
+	};
+
+	void SDLCanvas::blit(const Framebuffer& source)
+	{
+		flush();
+		if (source.width() != m_width || source.height() != m_height)
+			return;
+		if (!m_texture)
+		{
+			//RGBA bytes in memory, whatever the endianness
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+			Uint32 format = SDL_PIXELFORMAT_ABGR8888;
+#else
+			Uint32 format = SDL_PIXELFORMAT_RGBA8888;
+#endif
+			m_texture = SDL_CreateTexture(m_renderer, format, SDL_TEXTUREACCESS_STREAMING, m_width, m_height);
+			if (!m_texture)
+				return;
+		}
+		SDL_UpdateTexture(m_texture, nullptr, source.data(), 4 * m_width);
+		SDL_RenderCopy(m_renderer, m_texture, nullptr, nullptr);
+	}
+}
@@ -1,5 +1,214 @@
 #pragma once
-#include <string>
-#include <map>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
+/*! \file Factory.h
+\brief Header files containing the typed pools the images make their shapes in.
 
+Gives access to the Pool and Factory classes : objects are constructed in chunks of slots kept from one use to the next,
+so an image replaced again and again makes its shapes in the same memory instead of allocating each of them.
+*/
+
+namespace Patchwork
+{
+	/*!
+	Pool of objects of type T, constructed in the slots of chunks allocated when needed, each one twice as big as the previous one.
+	A released slot is reused by the next make, and clear destroys every object at once while keeping the chunks.
+	The pool is not thread safe and can't be copied.
+	*/
+	template <typename T>
+	class Pool
+	{
+	public:
+		Pool() : size_(0) {}
+		~Pool() { clear(); }
+		Pool(const Pool&) = delete;
+		Pool& operator=(const Pool&) = delete;
+
+		/*!
+		Construct an object from args in a free slot
+		*/
+		template <typename... Args>
+		T* make(Args&&... args)
+		{
+			if (free_.empty())
+				grow();
+			Slot* slot = free_.back();
+			T* object = new (&slot->storage) T(std::forward<Args>(args)...);
+			free_.pop_back();
+			slot->live = true;
+			++size_;
+			return object;
+		}
+		/*!
+		Destroy an object made by this pool, its slot is reused by the next make
+		*/
+		void release(T* object)
+		{
+			Slot* slot = reinterpret_cast<Slot*>(object);
+			object->~T();
+			slot->live = false;
+			free_.push_back(slot);
+			--size_;
+		}
+		/*!
+		Whether the object lies in the chunks of this pool
+		*/
+		bool owns(const T* object) const
+		{
+			const Slot* slot = reinterpret_cast<const Slot*>(object);
+			std::less<const Slot*> less;
+			for (auto& chunk : chunks_)
+			{
+				if (!less(slot, chunk.slots.get()) && less(slot, chunk.slots.get() + chunk.size))
+					return true;
+			}
+			return false;
+		}
+		/*!
+		Destroy every object at once. The chunks are kept, the next objects are made in the same slots, in the same order.
+		*/
+		void clear()
+		{
+			free_.clear();
+			for (auto chunk = chunks_.rbegin(); chunk != chunks_.rend(); ++chunk)
+			{
+				for (std::size_t k = chunk->size; k-- > 0;)
+				{
+					Slot& slot = chunk->slots[k];
+					if (slot.live)
+					{
+						reinterpret_cast<T*>(&slot.storage)->~T();
+						slot.live = false;
+					}
+					free_.push_back(&slot);
+				}
+			}
+			size_ = 0;
+		}
+		/*!
+		Number of objects alive
+		*/
+		std::size_t size() const { return size_; }
+		/*!
+		Number of slots, free or not
+		*/
+		std::size_t capacity() const
+		{
+			std::size_t capacity = 0;
+			for (auto& chunk : chunks_)
+				capacity += chunk.size;
+			return capacity;
+		}
+
+	private:
+		/*!
+		Room for one object, the object first so its address is the slot's
+		*/
+		struct Slot
+		{
+			typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+			bool live; /*!< Whether an object is constructed in the slot */
+		};
+		struct Chunk
+		{
+			std::unique_ptr<Slot[]> slots;
+			std::size_t size;
+		};
+		/*!
+		Allocate a new chunk, its slots are used first to last
+		*/
+		void grow()
+		{
+			std::size_t n = first_chunk;
+			if (!chunks_.empty())
+				n = 2 * chunks_.back().size;
+			Chunk chunk = { std::unique_ptr<Slot[]>(new Slot[n]), n };
+			for (std::size_t k = n; k-- > 0;)
+			{
+				chunk.slots[k].live = false;
+				free_.push_back(&chunk.slots[k]);
+			}
+			chunks_.push_back(std::move(chunk));
+		}
+
+		static const std::size_t first_chunk = 16; /*!< Slots of the first chunk */
+		std::vector<Chunk> chunks_; /*!< Chunks allocated so far */
+		std::vector<Slot*> free_; /*!< Free slots, the next one used last */
+		std::size_t size_; /*!< Number of objects alive */
+	};
+
+	/*!
+	Factory making objects of the given types, each type in its own Pool.
+	Factory<Circle, Polygon> f; Polygon* p = f.make<Polygon>(points, color); ... f.release(p); or f.clear() to destroy them all.
+	*/
+	template <typename... Types>
+	class Factory;
+
+	/*!
+	Factory of no type, ending the list of pools
+	*/
+	template <>
+	class Factory<>
+	{
+	public:
+		void clear() {}
+		std::size_t size() const { return 0; }
+		std::size_t capacity() const { return 0; }
+
+	protected:
+		void pool() const {}
+	};
+
+	template <typename T, typename... Rest>
+	class Factory<T, Rest...> : private Factory<Rest...>
+	{
+		typedef Factory<Rest...> Base;
+
+	public:
+		/*!
+		Construct an object of type U from args in the pool of U
+		*/
+		template <typename U, typename... Args>
+		U* make(Args&&... args) { return pool((const U*)nullptr).make(std::forward<Args>(args)...); }
+		/*!
+		Destroy an object made by this factory
+		*/
+		template <typename U>
+		void release(U* object) { pool((const U*)nullptr).release(object); }
+		/*!
+		Whether the object lies in the pool of its type
+		*/
+		template <typename U>
+		bool owns(const U* object) const { return pool((const U*)nullptr).owns(object); }
+		/*!
+		Destroy every object at once, keeping the memory of the pools
+		*/
+		void clear()
+		{
+			pool_.clear();
+			Base::clear();
+		}
+		/*!
+		Number of objects alive
+		*/
+		std::size_t size() const { return pool_.size() + Base::size(); }
+		/*!
+		Number of slots of the pools, free or not
+		*/
+		std::size_t capacity() const { return pool_.capacity() + Base::capacity(); }
+
+	protected:
+		using Base::pool;
+		Pool<T>& pool(const T*) { return pool_; }
+		const Pool<T>& pool(const T*) const { return pool_; }
+
+	private:
+		Pool<T> pool_; /*!< Pool of the objects of type T */
+	};
+}
@@ -0,0 +1,167 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/*! \file Grid.h
+\brief Header files containing a uniform grid indexing items by their bounding box.
+
+Gives access to the Grid class, answering "which items overlap this region" by looking only at the cells of the region.
+*/
+
+namespace Patchwork
+{
+	/*!
+	Uniform grid of square cells, each cell listing the items whose bounding box overlaps it.
+	Items covering more than max_cells cells are kept aside in a list checked by every query, so big items don't fill the grid.
+	Items are pointers, compared by address. The grid is not thread safe.
+	*/
+	template <typename T>
+	class Grid
+	{
+	public:
+		/*!
+		Create an empty grid
+		\param cell_size Width and height of a cell
+		\param max_cells Cells an item can cover before being kept aside
+		*/
+		Grid(float cell_size = 64.f, std::size_t max_cells = 64) : cell_size_(cell_size > 0.f ? cell_size : 64.f), max_cells_(max_cells) {}
+		/*!
+		Remove every item
+		*/
+		void clear()
+		{
+			cells_.clear();
+			entries_.clear();
+			big_.clear();
+		}
+		/*!
+		Number of items
+		*/
+		std::size_t size() const { return entries_.size(); }
+		/*!
+		Getter for the size of the cells
+		*/
+		float cell_size() const { return cell_size_; }
+		/*!
+		Add an item with its bounding box, or move it if it is already there
+		*/
+		void insert(T* item, float x_min, float y_min, float x_max, float y_max)
+		{
+			remove(item);
+			Entry e = { x_min, y_min, x_max, y_max, cell(x_min), cell(y_min), cell(x_max), cell(y_max), false };
+			e.big = (double)(e.cx1 - e.cx0 + 1) * (e.cy1 - e.cy0 + 1) > (double)max_cells_;
+			entries_[item] = e;
+			if (e.big)
+			{
+				big_.push_back(item);
+				return;
+			}
+			for (int cy = e.cy0; cy <= e.cy1; ++cy)
+				for (int cx = e.cx0; cx <= e.cx1; ++cx)
+					cells_[key(cx, cy)].push_back(item);
+		}
+		/*!
+		Remove an item, nothing happens if it is not there
+		*/
+		void remove(T* item)
+		{
+			auto it = entries_.find(item);
+			if (it == entries_.end())
+				return;
+			const Entry& e = it->second;
+			if (e.big)
+			{
+				big_.erase(std::find(big_.begin(), big_.end(), item));
+			}
+			else
+			{
+				for (int cy = e.cy0; cy <= e.cy1; ++cy)
+					for (int cx = e.cx0; cx <= e.cx1; ++cx)
+					{
+						auto cell = cells_.find(key(cx, cy));
+						cell->second.erase(std::find(cell->second.begin(), cell->second.end(), item));
+						if (cell->second.empty())
+							cells_.erase(cell);
+					}
+			}
+			entries_.erase(it);
+		}
+		/*!
+		Append to out every item whose bounding box overlaps the region, once each and in no particular order
+		*/
+		void query(float x_min, float y_min, float x_max, float y_max, std::vector<T*>& out) const
+		{
+			for (auto item : big_)
+			{
+				if (overlaps(entries_.at(item), x_min, y_min, x_max, y_max))
+					out.push_back(item);
+			}
+			int cx0 = cell(x_min), cy0 = cell(y_min), cx1 = cell(x_max), cy1 = cell(y_max);
+			auto visit = [&](int cx, int cy, const std::vector<T*>& items)
+			{
+				for (auto item : items)
+				{
+					//An item is reported by the first cell it shares with the region only
+					const Entry& e = entries_.at(item);
+					if (cx == std::max(cx0, e.cx0) && cy == std::max(cy0, e.cy0) && overlaps(e, x_min, y_min, x_max, y_max))
+						out.push_back(item);
+				}
+			};
+			if ((double)(cx1 - cx0 + 1) * (cy1 - cy0 + 1) > (double)cells_.size())
+			{
+				//The region covers more cells than there are in use, walk the cells in use instead
+				for (auto& cell : cells_)
+				{
+					int cx = (int)(int32_t)(uint32_t)(cell.first >> 32);
+					int cy = (int)(int32_t)(uint32_t)(cell.first & 0xffffffffu);
+					if (cx >= cx0 && cx <= cx1 && cy >= cy0 && cy <= cy1)
+						visit(cx, cy, cell.second);
+				}
+				return;
+			}
+			for (int cy = cy0; cy <= cy1; ++cy)
+				for (int cx = cx0; cx <= cx1; ++cx)
+				{
+					auto cell = cells_.find(key(cx, cy));
+					if (cell != cells_.end())
+						visit(cx, cy, cell->second);
+				}
+		}
+
+	private:
+		/*!
+		An item's bounding box and the cells it covers
+		*/
+		struct Entry
+		{
+			float x_min, y_min, x_max, y_max;
+			int cx0, cy0, cx1, cy1;
+			bool big; /*!< Kept aside instead of listed in the cells */
+		};
+		/*!
+		Cell of a coordinate, clamped so far away coordinates stay representable
+		*/
+		int cell(float v) const
+		{
+			float c = std::floor(v / cell_size_);
+			return (int)std::max(-1e9f, std::min(c, 1e9f));
+		}
+		static uint64_t key(int cx, int cy)
+		{
+			return ((uint64_t)(uint32_t)cx << 32) | (uint32_t)cy;
+		}
+		static bool overlaps(const Entry& e, float x_min, float y_min, float x_max, float y_max)
+		{
+			return e.x_min <= x_max && e.x_max >= x_min && e.y_min <= y_max && e.y_max >= y_min;
+		}
+
+		float cell_size_; /*!< Width and height of a cell */
+		std::size_t max_cells_; /*!< Cells an item can cover before being kept aside */
+		std::unordered_map<uint64_t, std::vector<T*>> cells_; /*!< Items of each cell in use */
+		std::unordered_map<T*, Entry> entries_; /*!< Every item with its box */
+		std::vector<T*> big_; /*!< Items kept aside */
+	};
+}
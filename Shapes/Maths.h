@@ -120,3 +120,89 @@ float norm(Vec2& a)
 {
 	return (fast_sqrt((a.x * a.x) + (a.y * a.y)));
 }
+
+/*!
+Structure to contain a 2D affine transform, as the 2x3 matrix
+	| a b tx |
+	| c d ty |
+mapping the point p to (a*p.x + b*p.y + tx, c*p.x + d*p.y + ty). Initialized to the identity.
+The transforms of the shapes are built with the static functions below, and chained with operator* : (m * n) applies n, then m.
+*/
+struct Affine
+{
+	Affine() : a(1.f), b(0.f), c(0.f), d(1.f), tx(0.f), ty(0.f) {}
+	Affine(float a, float b, float c, float d, float tx, float ty) : a(a), b(b), c(c), d(d), tx(tx), ty(ty) {}
+
+	float a, b, c, d; /*!< Linear part, rows (a b) and (c d) */
+	float tx, ty; /*!< Translation part */
+
+	/*!
+	Image of the point p
+	*/
+	Vec2 apply(const Vec2& p) const { return Vec2((a * p.x + b * p.y) + tx, (c * p.x + d * p.y) + ty); }
+	/*!
+	Image of the vector v : the translation does not apply
+	*/
+	Vec2 apply_vector(const Vec2& v) const { return Vec2(a * v.x + b * v.y, c * v.x + d * v.y); }
+	/*!
+	Ratio applied to the lengths, exact for the transforms built below and their chains (no shear nor stretch)
+	*/
+	float scale() const
+	{
+		float det = a * d - b * c;
+		return (float)fast_sqrt(det < 0.f ? -det : det);
+	}
+	/*!
+	Whether the transform only translates
+	*/
+	bool is_translation() const { return a == 1.f && b == 0.f && c == 0.f && d == 1.f; }
+	/*!
+	Whether the transform changes nothing
+	*/
+	bool is_identity() const { return is_translation() && tx == 0.f && ty == 0.f; }
+
+	/*!
+	Translation by the vector v
+	*/
+	static Affine translation(const Vec2& v) { return Affine(1.f, 0.f, 0.f, 1.f, v.x, v.y); }
+	/*!
+	Homothety of the given ratio around the point p : M |---> P + ratio * PM
+	*/
+	static Affine homothety(const Vec2& p, float ratio) { return Affine(ratio, 0.f, 0.f, ratio, p.x - ratio * p.x, p.y - ratio * p.y); }
+	/*!
+	Rotation of angle radiants around the point p, its sine and cosine are computed once
+	*/
+	static Affine rotation(const Vec2& p, double angle)
+	{
+		float s = (float)fast_sin(angle);
+		float c = (float)fast_cos(angle);
+		return Affine(c, -s, s, c, p.x - (c * p.x - s * p.y), p.y - (s * p.x + c * p.y));
+	}
+	/*!
+	Central symetry around the point p : M |---> 2P - M
+	*/
+	static Affine central_symmetry(const Vec2& p) { return Affine(-1.f, 0.f, 0.f, -1.f, 2.f * p.x, 2.f * p.y); }
+	/*!
+	Axial symetry across the line passing by the point p with the direction v (not null)
+	*/
+	static Affine axial_symmetry(const Vec2& p, const Vec2& v)
+	{
+		float l = v.x * v.x + v.y * v.y;
+		float xx = (v.x * v.x - v.y * v.y) / l;
+		float xy = 2.f * v.x * v.y / l;
+		Affine m(xx, xy, xy, -xx, 0.f, 0.f);
+		Vec2 t = p - m.apply_vector(p);
+		m.tx = t.x;
+		m.ty = t.y;
+		return m;
+	}
+};
+/*!
+Chain two transforms : the result applies n, then m
+*/
+Affine operator* (const Affine& m, const Affine& n)
+{
+	return Affine(m.a * n.a + m.b * n.c, m.a * n.b + m.b * n.d,
+		m.c * n.a + m.d * n.c, m.c * n.b + m.d * n.d,
+		m.a * n.tx + m.b * n.ty + m.tx, m.c * n.tx + m.d * n.ty + m.ty);
+}
@@ -0,0 +1,188 @@
+#pragma once
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "Maths.h"
+#include "Simd.h"
+
+/*! \file Raster.h
+\brief Header files containing the scanline rasterization of the shapes.
+
+Instead of testing every pixel of the bounding box, the extent of each row of a shape is computed once and the row is emitted as a span.
+The extents are computed with the very same floating point predicates the per pixel tests used, so the covered pixels are identical.
+*/
+
+namespace Patchwork
+{
+	/*!
+	Interface receiving the spans produced by the rasterizer.
+	A span covers the pixels x0 to x1 (excluded) of the row y.
+	*/
+	class SpanSink
+	{
+	public:
+		virtual ~SpanSink() {}
+		virtual void span(int y, int x0, int x1) = 0;
+	};
+
+	namespace Raster
+	{
+		/*!
+		Find the largest m such that inside(m) holds, knowing inside is true up to some m then false, starting from the estimate guess.
+		Return -1 if inside(0) is false.
+		*/
+		template <typename Inside>
+		int extent(int guess, int limit, Inside inside)
+		{
+			int m = std::max(0, std::min(guess, limit));
+			while (m >= 0 && !inside(m))
+				--m;
+			while (m >= 0 && m < limit && inside(m + 1))
+				++m;
+			return m;
+		}
+		/*!
+		An edge of a polygon being rasterized
+		*/
+		struct Edge
+		{
+			Vec2 a, b; /*!< a is the current vertex, b the previous one, as in the crossing test */
+			int first, last; /*!< Rows crossed by the edge */
+		};
+		/*!
+		Buffers of the rasterizer, kept from one shape to the next so drawing allocates nothing once they are big enough
+		*/
+		struct Scratch
+		{
+			std::vector<Vec2> points; /*!< Free for the callers, to transform the vertices of a polygon before rasterizing it */
+			std::vector<Edge> edges; /*!< Edges of the polygon */
+			std::vector<const Edge*> active; /*!< Edges crossed by the current row */
+			std::vector<float> ax, ay, bx, by, crossings; /*!< Active edges and their crossings, as arrays for the SIMD kernels */
+		};
+		/*!
+		The buffers of the calling thread
+		*/
+		inline Scratch& scratch()
+		{
+			static thread_local Scratch buffers;
+			return buffers;
+		}
+		/*!
+		Emit the span of the pixels i0 to i1 (included) of the row j, relative to the point p, converted to pixels as the per pixel code does
+		*/
+		inline void emit(SpanSink& sink, const Vec2& p, int j, int i0, int i1)
+		{
+			if (i0 <= i1)
+				sink.span((int)(p.y + j), (int)(p.x + i0), (int)(p.x + i1) + 1);
+		}
+	}
+
+	/*!
+	Rasterize a filled circle of the given radius centered on p (in pixels).
+	Covers the pixels (int)(p.x + i), (int)(p.y + j) for i and j in [-(int)radius, (int)radius) such that i*i + j*j <= radius*radius.
+	*/
+	void rasterize_circle(SpanSink& sink, const Vec2& p, float radius)
+	{
+		int r = (int)radius;
+		for (int j = -r; j < r; ++j)
+		{
+			float rest = radius*radius - (float)j*j;
+			int guess = rest > 0.f ? (int)std::sqrt(rest) : 0;
+			int m = Raster::extent(guess, r, [&](int i) { return Raster::in_circle(i, j, radius); });
+			if (m >= 0)
+				Raster::emit(sink, p, j, -std::min(m, r), std::min(m, r - 1));
+		}
+	}
+
+	/*!
+	Rasterize a filled ellipse of the given radii centered on p (in pixels).
+	Covers the same pixels as testing every pixel of its bounding box with the ellipse equation.
+	*/
+	void rasterize_ellipse(SpanSink& sink, const Vec2& p, const Vec2& radius)
+	{
+		int rx = (int)radius.x;
+		int ry = (int)radius.y;
+		if (rx <= 0 || ry <= 0)
+			return;
+		for (int j = -ry; j < ry; ++j)
+		{
+			//x extent of the row from the ellipse equation, then made exact with the predicate
+			float t = 1.f - ((float)j*j) / (radius.y*radius.y);
+			int guess = t > 0.f ? (int)(radius.x * std::sqrt(t)) : 0;
+			int m = Raster::extent(guess, rx, [&](int i) { return Raster::in_ellipse(i, j, radius); });
+			if (m >= 0)
+				Raster::emit(sink, p, j, -std::min(m, rx), std::min(m, rx - 1));
+		}
+	}
+
+	/*!
+	Rasterize a filled polygon with the even-odd rule, shifted by offset (in pixels), testing only the columns x0 to x1 (excluded) and the rows y0 to y1 (excluded).
+	Covers the same pixels as testing each pixel (x, y) with the crossing test of Polygon::isPointInPolygon :
+	an edge (a, b) is crossed by the row y if exactly one of a.y and b.y is >= y, at c = (b.x - a.x) * (y - a.y) / (b.y - a.y) + a.x,
+	and the pixel is inside if an odd number of crossings are >= x.
+	The edges are kept in an active edge table so each row only looks at the edges it crosses, whatever the number of vertices.
+	*/
+	void rasterize_polygon(SpanSink& sink, const std::vector<Vec2>& points, const Vec2& offset, int x0, int x1, int y0, int y1)
+	{
+		typedef Raster::Edge Edge;
+		Raster::Scratch& scratch = Raster::scratch();
+		std::vector<Edge>& edges = scratch.edges;
+		edges.clear();
+		std::size_t n = points.size();
+		for (std::size_t i = 0, j = n - 1; i < n; j = i++)
+		{
+			//The row y is crossed when y is in (floor(low y), floor(high y)]
+			int fa = (int)std::floor(points[i].y);
+			int fb = (int)std::floor(points[j].y);
+			if (fa == fb)
+				continue;
+			Edge e = { points[i], points[j], std::max(std::min(fa, fb) + 1, y0), std::min(std::max(fa, fb), y1 - 1) };
+			if (e.first <= e.last)
+				edges.push_back(e);
+		}
+		if (edges.empty())
+			return;
+		std::sort(edges.begin(), edges.end(), [](const Edge& l, const Edge& r) { return l.first < r.first; });
+
+		std::vector<const Edge*>& active = scratch.active;
+		std::vector<float>& ax = scratch.ax, &ay = scratch.ay, &bx = scratch.bx, &by = scratch.by, &crossings = scratch.crossings;
+		active.clear();
+		std::size_t next = 0;
+		for (int y = edges.front().first; y < y1 && (next < edges.size() || !active.empty()); ++y)
+		{
+			//Update the active edges
+			active.erase(std::remove_if(active.begin(), active.end(), [y](const Edge* e) { return e->last < y; }), active.end());
+			while (next < edges.size() && edges[next].first <= y)
+				active.push_back(&edges[next++]);
+			if (active.empty())
+				continue;
+
+			float py = (float)y;
+			//Crossings of the active edges, several at once (see Simd.h)
+			std::size_t count = active.size();
+			ax.resize(count), ay.resize(count), bx.resize(count), by.resize(count), crossings.resize(count);
+			for (std::size_t k = 0; k < count; ++k)
+			{
+				ax[k] = active[k]->a.x;
+				ay[k] = active[k]->a.y;
+				bx[k] = active[k]->b.x;
+				by[k] = active[k]->b.y;
+			}
+			Simd::crossings(ax.data(), ay.data(), bx.data(), by.data(), count, py, crossings.data());
+			std::sort(crossings.begin(), crossings.end());
+
+			//Inside between each pair of crossings, x in (crossings[k], crossings[k + 1]]
+			for (std::size_t k = 0; k + 1 < crossings.size(); k += 2)
+			{
+				float lo = crossings[k];
+				float hi = crossings[k + 1];
+				if (lo >= x1 || hi < x0)
+					continue;
+				int start = lo < x0 ? x0 : (int)std::floor(lo) + 1;
+				int end = hi >= x1 ? x1 - 1 : (int)std::floor(hi);
+				if (start <= end)
+					sink.span((int)(py + offset.y), (int)(start + offset.x), (int)(end + offset.x) + 1);
+			}
+		}
+	}
+}
@@ -5,8 +5,18 @@
 #include <iomanip>
 #include <sstream>
 #include <mutex>
+#include <thread>
+#include <atomic>
+#include <memory>
 #include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <map>
 #include "Maths.h"
+#include "Canvas.h"
+#include "Grid.h"
+#include "Factory.h"
 #include "SDL2/SDL.h"
 
 /*! \file Shape.h
@@ -40,18 +50,187 @@ namespace Patchwork
 		return stream.str();
 	}
 	/*!
+	Encodings available to serialize an image : the historical human readable text, or the compact binary codec.
+	*/
+	enum Encoding { TEXT = 0, BINARY };
+	/*!
+	First byte of every binary payload. A text payload never starts with it, so a receiver can tell both encodings apart.
+	*/
+	const char binary_marker = '\0';
+	/*!
+	Append a single byte to a binary payload
+	*/
+	void write_byte(std::string& out, unsigned char b)
+	{
+		out.push_back(static_cast<char>(b));
+	}
+	/*!
+	Append a float to a binary payload as a raw little endian float32
+	*/
+	void write_float(std::string& out, float f)
+	{
+		uint32_t bits;
+		std::memcpy(&bits, &f, sizeof(bits));
+		char bytes[4] = { (char)(bits & 0xFF), (char)((bits >> 8) & 0xFF), (char)((bits >> 16) & 0xFF), (char)((bits >> 24) & 0xFF) };
+		out.append(bytes, 4);
+	}
+	/*!
+	Append an unsigned integer to a binary payload as a varint (7 bits per byte, high bit set while more bytes follow)
+	*/
+	void write_varint(std::string& out, uint32_t v)
+	{
+		while (v >= 0x80)
+		{
+			out.push_back(static_cast<char>((v & 0x7F) | 0x80));
+			v >>= 7;
+		}
+		out.push_back(static_cast<char>(v));
+	}
+	/*!
+	Append a color to a binary payload as packed RGB, one byte per channel.
+	Channels are clamped to [0,255], the only range that makes sense on the wire.
+	*/
+	void write_color(std::string& out, const Color& c)
+	{
+		write_byte(out, (unsigned char)std::min(std::max(c.r, 0), 255));
+		write_byte(out, (unsigned char)std::min(std::max(c.g, 0), 255));
+		write_byte(out, (unsigned char)std::min(std::max(c.b, 0), 255));
+	}
+	/*!
+	Append a string to a binary payload as its varint length followed by its bytes
+	*/
+	void write_string(std::string& out, const std::string& str)
+	{
+		write_varint(out, (uint32_t)str.size());
+		out.append(str);
+	}
+	/*!
+	Cursor over a binary payload, reading back what the write_* functions produced.
+	Reading past the end does not throw : it returns zeros and ok() becomes false.
+	*/
+	class BinaryReader
+	{
+	public:
+		BinaryReader(const char* data, std::size_t size) : cur_(data), end_(data + size), ok_(true) {}
+		/*!
+		False as soon as a read went past the end of the payload
+		*/
+		bool ok() const { return ok_; }
+		/*!
+		Number of bytes left to read
+		*/
+		std::size_t remaining() const { return (std::size_t)(end_ - cur_); }
+
+		unsigned char read_byte()
+		{
+			if (!check(1))
+				return 0;
+			return static_cast<unsigned char>(*cur_++);
+		}
+
+		float read_float()
+		{
+			if (!check(4))
+				return 0.f;
+			const unsigned char* b = reinterpret_cast<const unsigned char*>(cur_);
+			uint32_t bits = (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+			cur_ += 4;
+			float f;
+			std::memcpy(&f, &bits, sizeof(f));
+			return f;
+		}
+
+		uint32_t read_varint()
+		{
+			uint32_t v = 0;
+			for (int shift = 0; shift < 35; shift += 7)
+			{
+				unsigned char b = read_byte();
+				if (!ok_)
+					return 0;
+				v |= (uint32_t)(b & 0x7F) << shift;
+				if (!(b & 0x80))
+					return v;
+			}
+			ok_ = false;
+			return 0;
+		}
+
+		Color read_color()
+		{
+			int r = read_byte();
+			int g = read_byte();
+			int b = read_byte();
+			return Color(r, g, b);
+		}
+
+		std::string read_string()
+		{
+			uint32_t size = read_varint();
+			if (!check(size))
+				return std::string();
+			std::string str(cur_, size);
+			cur_ += size;
+			return str;
+		}
+
+	private:
+		bool check(std::size_t n)
+		{
+			if (!ok_ || remaining() < n)
+			{
+				ok_ = false;
+				return false;
+			}
+			return true;
+		}
+
+		const char* cur_; /*!< Next byte to read */
+		const char* end_; /*!< One past the last byte */
+		bool ok_; /*!< False once a read failed */
+	};
+	/*!
 	A structure for a bounding box object defined by two points :
 	upper left and lower right corners.
-	The structure is initialized with minimal value for maximums and maximal value for minimums (integer 10000), so it can be used
-	right away to compute min and max.
+	The structure is initialized with the lowest float for maximums and the greatest for minimums, so it can be used
+	right away to compute min and max, and is empty until then.
 	*/
 	struct BoundingBox
 	{
-		int x_max; /*!< Lower corner x coordinate */
-		int x_min; /*!< Upper corner x coordinate */
-		int y_max; /*!< Lower corner y coordinate */
-		int y_min; /*!< Upper corner y coordinate*/
-		BoundingBox() :x_max(-10000), y_max(-10000), x_min(10000), y_min(10000){}
+		float x_max; /*!< Lower corner x coordinate */
+		float x_min; /*!< Upper corner x coordinate */
+		float y_max; /*!< Lower corner y coordinate */
+		float y_min; /*!< Upper corner y coordinate*/
+		BoundingBox() :x_max(std::numeric_limits<float>::lowest()), x_min(std::numeric_limits<float>::max()),
+			y_max(std::numeric_limits<float>::lowest()), y_min(std::numeric_limits<float>::max()){}
+		/*!
+		Whether the box holds no point
+		*/
+		bool empty() const { return x_max < x_min || y_max < y_min; }
+		/*!
+		Grow the box to hold the box b
+		*/
+		void merge(const BoundingBox& b)
+		{
+			x_max = std::max(x_max, b.x_max);
+			x_min = std::min(x_min, b.x_min);
+			y_max = std::max(y_max, b.y_max);
+			y_min = std::min(y_min, b.y_min);
+		}
+	};
+	/*!
+	A view transform from the shapes coordinates to pixels : a scale around the origin, then an offset (usually the center of the target).
+	It is applied while rasterizing, which gives the same pixels as displaying a copy of the shape transformed by an homothety, without the copy.
+	*/
+	struct View
+	{
+		View(float scale = 1.f, const Vec2& offset = Vec2(0, 0)) : scale(scale), offset(offset) {}
+		/*!
+		Pixel position of a point
+		*/
+		Vec2 apply(const Vec2& p) const { return scale*p + offset; }
+		float scale; /*!< Scale of the shapes */
+		Vec2 offset; /*!< Pixel position of the origin */
 	};
 
 
@@ -118,7 +297,7 @@ namespace Patchwork
 		/*!
 		Constructor initializing the Derivedtype and color
 		*/
-		Shape(Derivedtype type, Color color) : m_type(type), m_color(color){};
+		Shape(Derivedtype type, Color color) : m_type(type), m_color(color), m_id(0), m_version(0){};
 		~Shape(){};
 		/*!
 		Getter for the variable type
@@ -129,6 +308,14 @@ namespace Patchwork
 		*/
 		const Color color() const { return(m_color); }
 		/*!
+		Getter for the identifier given by the Image owning the shape. It is stable over the network, 0 if the shape belongs to no Image.
+		*/
+		uint32_t id() const { return(m_id); }
+		/*!
+		Getter for the version of the owning Image at which the shape was last added or modified
+		*/
+		uint32_t version() const { return(m_version); }
+		/*!
 		Interface function, needed in inheriting classes, to compute the area of the shape.
 		*/
 		virtual float area() = 0;
@@ -170,25 +357,60 @@ namespace Patchwork
 		*/
 		virtual void axialSym(const Vec2& p, const Vec2& v) = 0;
 		/*!
-		Interface function, needed in inheriting classes, to display the shape with the SDL library.
+		Interface function, needed in inheriting classes, to apply an affine transform (see Affine), for instance a chain of the transforms above
+		composed once. The points of the shape are mapped by m and its lengths scaled by m.scale().
+		*/
+		virtual void transform(const Affine& m) = 0;
+		/*!
+		Interface function, needed in inheriting classes, to display the shape on a canvas (a SDL renderer or an in-memory framebuffer)
+		through a view transform, without modifying nor copying the shape.
+		*/
+		virtual void display(Canvas& canvas, const View& view) = 0;
+		/*!
+		Function to display the shape on a canvas, scaled by ratio around the center of the canvas.
+		*/
+		void display(Canvas& canvas, float ratio)
+		{
+			display(canvas, View(ratio, Vec2((canvas.width() / 2), (canvas.height() / 2))));
+		}
+		/*!
+		Function to display the shape with the SDL library.
 		It takes a renderer to write into and a ratio. If the ratio is different from 1.f, the shape will be transformed by an homothety.
 		*/
-		virtual void display(SDL_Renderer* renderer, float ratio) = 0;
+		void display(SDL_Renderer* renderer, float ratio)
+		{
+			SDLCanvas canvas(renderer);
+			display(canvas, ratio);
+		}
 		/*!
 		Interface function, needed in inheriting classes, to serialize the shape into a std::string.
 		*/
 		virtual void serialize( std::string& serial ) = 0;
 		/*!
+		Interface function, needed in inheriting classes, to append the shape to a binary payload :
+		a type tag byte, the varint id, the float32 coordinates, a varint vertex count when needed and the packed RGB color.
+		*/
+		virtual void encode(std::string& out) = 0;
+		/*!
 		Interface function, needed in inheriting classes, to compute the bounding box af the shape.
 		*/
 		virtual BoundingBox bounding_box() = 0;
 		/*!
+		Interface function, needed in inheriting classes, to tell whether the point p is on the shape (hit testing).
+		*/
+		virtual bool contains(const Vec2& p) = 0;
+		/*!
 		Out stream operator override, basically dispatch to the derivedtype owns override function
 		*/
 		friend std::ostream& operator<< (std::ostream &out, Shape &Shape);
 	protected:
 		Derivedtype m_type; /*!< The Derivedtype of the children */
 		Color m_color; /*!< The color of the shape as (R,G,B) value */
+		uint32_t m_id; /*!< Identifier given by the owning Image */
+		uint32_t m_version; /*!< Version of the owning Image at the last modification */
+
+		friend class Image;
+		friend class Packed;
 	};
 	//Static container definitions
 	const std::vector<std::string> Shape::transforms = { "rotate", "homothety", "translate", "axial_sym", "central_sym" };
@@ -283,36 +505,22 @@ namespace Patchwork
 			translate(2 * (intersection - m_origin));
 		}
 		/*!
-		Function to display the circle. If ratio is different from 1 then an homothety is applied before displaying the shape.
+		Function to apply the affine transform m : the center is mapped, the radius scaled
+		*/
+		void transform(const Affine& m)
+		{
+			m_origin = m.apply(m_origin);
+			m_radius *= m.scale();
+		}
+		/*!
+		Function to display the circle through the view, its center and radius are scaled on the fly.
 		As an image is made of pixels, an error is introduced by converting float point to integer, thus not displaying a "right" shape. This is a particular field called Digital Geometry and is out of the scope.
 		*/
-		void display(SDL_Renderer* renderer, float ratio)
+		using Shape::display;
+		void display(Canvas& canvas, const View& view)
 		{
-			if (ratio != 1.f)
-			{
-				Circle *c = new Circle( *this );
-				c->homothety(Vec2(0, 0), ratio);
-				c->display(renderer, 1.f);
-				delete c;
-			}
-			else
-			{
-				SDL_SetRenderDrawColor(renderer, m_color.r, m_color.g, m_color.b, 0x00);
-				int w, h;
-				SDL_GetRendererOutputSize(renderer, &w, &h);
-				Vec2 center((w / 2), (h / 2));
-				Vec2 displayablePoint = m_origin + center;
-				for (int i = -(int)(m_radius); i < (int)(m_radius); ++i)
-				{
-					for (int j = -(int)(m_radius); j < (int)(m_radius); ++j)
-					{
-						if (i*i + j*j <= m_radius*m_radius)
-						{
-							SDL_RenderDrawPoint(renderer, (int)(displayablePoint.x + i), (int)(displayablePoint.y + j));
-						}
-					}
-				}
-			}
+			canvas.set_color(m_color);
+			rasterize_circle(canvas, view.apply(m_origin), view.scale * m_radius);
 		}
 		/*!
 		Function to serialize the shape into a string
@@ -328,19 +536,39 @@ namespace Patchwork
 			serial = serial + " " + to_string(m_color.b);
 		}
 		/*!
+		Function to encode the shape into a binary payload
+		*/
+		void encode(std::string& out)
+		{
+			write_byte(out, CIRCLE);
+			write_varint(out, m_id);
+			write_float(out, m_origin.x);
+			write_float(out, m_origin.y);
+			write_float(out, m_radius);
+			write_color(out, m_color);
+		}
+		/*!
 		Function to compute the boudning box
 		*/
 		BoundingBox bounding_box()
 		{
 			BoundingBox bb = {};
-			bb.x_min = (int)(m_origin.x - m_radius);
-			bb.x_max = (int)(m_origin.x + m_radius);
-			bb.y_min = (int)(m_origin.y - m_radius);
-			bb.y_max = (int)(m_origin.y + m_radius);
+			bb.x_min = m_origin.x - m_radius;
+			bb.x_max = m_origin.x + m_radius;
+			bb.y_min = m_origin.y - m_radius;
+			bb.y_max = m_origin.y + m_radius;
 			
 			return bb;
 		}
 		/*!
+		Function to tell whether p is inside the circle
+		*/
+		bool contains(const Vec2& p)
+		{
+			Vec2 d = p - m_origin;
+			return dot(d, d) <= m_radius * m_radius;
+		}
+		/*!
 		Out stream operator override
 		*/
 		friend std::ostream& operator<< (std::ostream &out, const Circle &Circle);
@@ -425,122 +653,62 @@ namespace Patchwork
 		{ /*compute bounding rectangle and move points by (rect_center - points)*ratio */ 
 			BoundingBox bb = bounding_box();
 			Vec2 center = Vec2(bb.x_max - ((bb.x_max - bb.x_min) / 2.f), bb.y_max - ((bb.y_max - bb.y_min) / 2.f));
-			for (std::vector<Vec2>::iterator it = m_points.begin(); it != m_points.end(); ++it)
-			{
-				Vec2 u = ((*it) - center);
-				(*it) = center + ratio*u;
-			}
+			transform(Affine::homothety(center, ratio));
 		}
 		/*!
 		Function to compute the homothety with the point o as origin.
 		*/
-		void homothety(const Vec2& o, float ratio) 
-		{  
-			for (std::vector<Vec2>::iterator it = m_points.begin(); it != m_points.end(); ++it)
-			{
-				Vec2 u = ((*it) - o);
-				(*it) = o + ratio*u;
-			}
-		}
+		void homothety(const Vec2& o, float ratio) { transform(Affine::homothety(o, ratio)); }
 		/*!
 		Function to compute the rotation with the point p as origin and an angle in radiant.
 		*/
-		void rotate(const Vec2& p, double angle)
-		{
-			for (std::vector<Vec2>::iterator it = m_points.begin(); it != m_points.end(); ++it)
-			{
-				float s = fast_sin(angle);
-				float c = fast_cos(angle);
-				(*it).x -= p.x;
-				(*it).y -= p.y;
-				float x = ((*it).x * c - (*it).y * s) + p.x;
-				float y = ((*it).x * s + (*it).y * c) + p.y;
-				(*it).x = x;
-				(*it).y = y;
-			}
-		}
+		void rotate(const Vec2& p, double angle) { transform(Affine::rotation(p, angle)); }
 		/*!
-		Function to compute the rotation with an angle in radiant.
+		Function to compute the rotation with an angle in radiant, around the origin of the coordinates.
 		*/
-		void rotate(float angle)
-		{
-			for (std::vector<Vec2>::iterator it = m_points.begin(); it != m_points.end(); ++it)
-			{
-				float s = fast_sin(angle);
-				float c = fast_cos(angle);
-				float x = ((*it).x * c - (*it).y * s);
-				float y = ((*it).x * s + (*it).y * c);
-				(*it).x = x;
-				(*it).y = y;
-			}
-		}
+		void rotate(float angle) { transform(Affine::rotation(Vec2(0, 0), angle)); }
 		/*!
 		Function to compute the translation of a vector v, which is applied to every points
 		*/
-		void translate(const Vec2& v)
-		{
-			for (std::vector<Vec2>::iterator it = m_points.begin(); it != m_points.end(); ++it)
-			{
-				(*it) = (*it) + v;
-			}
-		}
+		void translate(const Vec2& v) { transform(Affine::translation(v)); }
 		/*!
 		Function to compute the central symetry with the point p as origin. Translate every point by 2*OP.
 		*/
-		void centralSym(const Vec2& p)
-		{
-			for (std::vector<Vec2>::iterator it = m_points.begin(); it != m_points.end(); ++it)
-			{
-				Vec2 t = 2 * (p - (*it));
-				(*it) = (*it) + t;
-			}
-		}
+		void centralSym(const Vec2& p) { transform(Affine::central_symmetry(p)); }
 		/*!
 		Function to compute the axial symetry with the line defined by the point p and a vector v.
 		*/
-		void axialSym(const Vec2& p, const Vec2& v)
-		{
-			for (std::vector<Vec2>::iterator it = m_points.begin(); it != m_points.end(); ++it)
-			{
-				Vec2 p1 = p + v;
-				Vec2 w = (*it) - p;
-				Vec2 vl = p1 - p;
-				float b = dot(w, vl) / dot(vl, vl);
-				Vec2 intersection = p + b * vl;
-				(*it) = (*it) + (2 * (intersection - (*it)));
-			}
-		}
+		void axialSym(const Vec2& p, const Vec2& v) { transform(Affine::axial_symmetry(p, v)); }
+		/*!
+		Function to apply the affine transform m to every point, in one vectorized pass
+		*/
+		void transform(const Affine& m) { Simd::transform(m, m_points.data(), m_points.size()); }
 		/*!
-		Function to display the shape. If ratio is different from 1 then an homothety is applied before displaying the shape.
+		Function to display the shape through the view, its vertices are scaled on the fly.
 		As an image is made of pixels, an error is introduced by converting float point to integer, thus not displaying a "right" shape. This is a particular field called Digital Geometry and is out of the scope.
 		*/
-		void display(SDL_Renderer* renderer, float ratio)
+		using Shape::display;
+		void display(Canvas& canvas, const View& view)
 		{
-			if (ratio != 1.f)
-			{
-				Polygon *c = new Polygon(*this);
-				c->homothety(Vec2(0, 0), ratio);
-				c->display(renderer, 1.f);
-				delete c;
-			}
-			else
+			canvas.set_color(m_color);
+			//The scaled vertices go to a buffer kept by the thread, the offset is applied by the rasterizer
+			std::vector<Vec2>& points = Raster::scratch().points;
+			points.clear();
+			BoundingBox bb;
+			for (auto& point : m_points)
 			{
-				SDL_SetRenderDrawColor(renderer, m_color.r, m_color.g, m_color.b, 0x00);
-				int w, h;
-				SDL_GetRendererOutputSize(renderer, &w, &h);
-				Vec2 center((w / 2), (h / 2));
-				BoundingBox bb = bounding_box();
-				for (int i = bb.x_min - 1; i < bb.x_max + 1; ++i)
-				{
-					for (int j = bb.y_min - 1; j < bb.y_max + 1; ++j)
-					{
-						if (isPointInPolygon(Vec2(i, j)))
-						{
-							SDL_RenderDrawPoint(renderer, i + center.x, j + center.y);
-						}
-					}
-				}
+				Vec2 p = view.scale * point;
+				points.push_back(p);
+				if (p.x < bb.x_min)
+					bb.x_min = p.x;
+				if (p.x > bb.x_max)
+					bb.x_max = p.x;
+				if (p.y < bb.y_min)
+					bb.y_min = p.y;
+				if (p.y > bb.y_max)
+					bb.y_max = p.y;
 			}
+			rasterize_polygon(canvas, points, view.offset, (int)bb.x_min - 1, (int)bb.x_max + 1, (int)bb.y_min - 1, (int)bb.y_max + 1);
 		}
 		/*!
 		Function to serialize the shape into a string
@@ -559,6 +727,21 @@ namespace Patchwork
 			serial = serial + " " + to_string(m_color.b);
 		}
 		/*!
+		Function to encode the shape into a binary payload
+		*/
+		void encode(std::string& out)
+		{
+			write_byte(out, POLYGON);
+			write_varint(out, m_id);
+			write_varint(out, (uint32_t)m_points.size());
+			for (auto point : m_points)
+			{
+				write_float(out, point.x);
+				write_float(out, point.y);
+			}
+			write_color(out, m_color);
+		}
+		/*!
 		Function to compute the bounding box
 		*/
 		BoundingBox bounding_box()
@@ -567,17 +750,25 @@ namespace Patchwork
 			for (auto point : m_points)
 			{
 				if (point.x < bb.x_min)
-					bb.x_min = (int)point.x;
+					bb.x_min = point.x;
 				if (point.x > bb.x_max)
-					bb.x_max = (int)point.x;
+					bb.x_max = point.x;
 				if (point.y < bb.y_min)
-					bb.y_min = (int)point.y;
+					bb.y_min = point.y;
 				if (point.y > bb.y_max)
-					bb.y_max = (int)point.y;					
+					bb.y_max = point.y;
 			}
 			return bb;
 		}
 		/*!
+		Function to tell whether p is inside the polygon
+		*/
+		bool contains(const Vec2& p)
+		{
+			Vec2 q = p;
+			return isPointInPolygon(q);
+		}
+		/*!
 		Out stream operator override
 		*/
 		friend std::ostream& operator<< (std::ostream &out, const Polygon &Polygon);
@@ -673,13 +864,13 @@ namespace Patchwork
 		*/
 		float perimeter() { return(1.f); }
 		/*!
-		Function to compute the homothety. The homthety of a line makes no sens, hance the empty function
+		Function to compute the homothety. A line keeps its length (see transform), so its own homothety leaves it unchanged
 		*/
 		void homothety(float ratio) { /*NON SENSE*/ }
 		/*!
-		Function to compute the homothety. The homthety of a line makes no sens, hance the empty function
+		Function to compute the homothety with the point p as origin. The point is moved, the direction keeps its length (see transform).
 		*/
-		void homothety(const Vec2& p, float ratio) { /*NON SENSE*/ }
+		void homothety(const Vec2& p, float ratio) { transform(Affine::homothety(p, ratio)); }
 		/*!
 		Function to compute the rotation with an angle in radiant. Take two points of the line, rotate them and compute back the direction.
 		*/
@@ -729,27 +920,36 @@ namespace Patchwork
 		*/
 		void axialSym(const Vec2& p, const Vec2& d){ /*NON SENSE*/ }
 		/*!
-		Function to display the shape. If ratio is different from 1 then an homothety is applied before displaying the shape.
+		Function to apply the affine transform m : the point is mapped, the direction turned as a vector but keeping its length,
+		as a line is drawn unscaled
+		*/
+		void transform(const Affine& m)
+		{
+			m_point = m.apply(m_point);
+			m_direction = turn(m, m_direction);
+		}
+		/*!
+		The direction d transformed by m as a vector, brought back to the length of d (null if m squashes it)
+		*/
+		static Vec2 turn(const Affine& m, const Vec2& d)
+		{
+			Vec2 t = m.apply_vector(d);
+			float length = std::sqrt(t.x * t.x + t.y * t.y);
+			if (length == 0.f)
+				return t;
+			return (std::sqrt(d.x * d.x + d.y * d.y) / length) * t;
+		}
+		/*!
+		Function to display the shape through the view.
 		As an image is made of pixels, an error is introduced by converting float point to integer, thus not displaying a "right" shape. This is a particular field called Digital Geometry and is out of the scope.
 		*/
-		void display(SDL_Renderer* renderer, float ratio)
+		using Shape::display;
+		void display(Canvas& canvas, const View& view)
 		{
-			if (ratio != 1.f)
-			{
-				Line *c = new Line(*this);
-				c->homothety(Vec2(0, 0), ratio);
-				c->display(renderer, 1.f);
-				delete c;
-			}
-			else
-			{
-				SDL_SetRenderDrawColor(renderer, m_color.r, m_color.g, m_color.b, 0x00);
-				int w, h;
-				SDL_GetRendererOutputSize(renderer, &w, &h);
-				Vec2 center((w / 2), (h / 2));
-				Vec2 displayablePoint = m_point + center;
-				SDL_RenderDrawLine(renderer, (int)displayablePoint.x, (int)displayablePoint.y, (int)(displayablePoint.x + m_direction.x), (int)(displayablePoint.y + m_direction.y));
-			}
+			//A line is drawn unscaled, only the offset of the view applies
+			canvas.set_color(m_color);
+			Vec2 displayablePoint = m_point + view.offset;
+			canvas.line((int)displayablePoint.x, (int)displayablePoint.y, (int)(displayablePoint.x + m_direction.x), (int)(displayablePoint.y + m_direction.y));
 		}
 		/*!
 		Function to serialize the shape into a string
@@ -766,24 +966,44 @@ namespace Patchwork
 			serial = serial + " " + to_string(m_color.b);
 		}
 		/*!
+		Function to encode the shape into a binary payload
+		*/
+		void encode(std::string& out)
+		{
+			write_byte(out, LINE);
+			write_varint(out, m_id);
+			write_float(out, m_point.x);
+			write_float(out, m_point.y);
+			write_float(out, m_direction.x);
+			write_float(out, m_direction.y);
+			write_color(out, m_color);
+		}
+		/*!
 		Function to compute the bounding box
 		*/
 		BoundingBox bounding_box()
 		{
 			BoundingBox bb;
 			Vec2 p2 = m_point + m_direction;
-			if (p2.x < m_point.x)
-			{	bb.x_min = p2.x;
-			    bb.x_max = m_point.x;
-		    }
-			if (p2.y < m_point.y)
-			{
-				bb.y_min = p2.y;
-				bb.y_max = m_point.y;
-			}
+			bb.x_min = std::min(m_point.x, p2.x);
+			bb.x_max = std::max(m_point.x, p2.x);
+			bb.y_min = std::min(m_point.y, p2.y);
+			bb.y_max = std::max(m_point.y, p2.y);
 			return bb;
 		}
 		/*!
+		Function to tell whether p is on the line, drawn as a segment of one pixel width : p is at most half a pixel from it
+		*/
+		bool contains(const Vec2& p)
+		{
+			Vec2 w = p - m_point;
+			Vec2 d = m_direction;
+			float length = dot(d, d);
+			float t = length > 0.f ? std::max(0.f, std::min(1.f, dot(w, d) / length)) : 0.f;
+			Vec2 gap = w - t * d;
+			return dot(gap, gap) <= 0.25f;
+		}
+		/*!
 		Out stream operator override
 		*/
 		friend std::ostream& operator<< (std::ostream &out, const Line &Line);
@@ -902,36 +1122,22 @@ namespace Patchwork
 			translate(2 * (intersection - m_origin));
 		}
 		/*!
-		Function to display the shape. If ratio is different from 1 then an homothety is applied before displaying the shape.
+		Function to apply the affine transform m : the center is mapped, the radii scaled. As for rotate, the axes can't turn.
+		*/
+		void transform(const Affine& m)
+		{
+			m_origin = m.apply(m_origin);
+			m_radius = m.scale() * m_radius;
+		}
+		/*!
+		Function to display the ellipse through the view, its center and radii are scaled on the fly.
 		As an image is made of pixels, an error is introduced by converting float point to integer, thus not displaying a "right" shape. This is a particular field called Digital Geometry and is out of the scope.
 		*/
-		void display(SDL_Renderer* renderer, float ratio)
+		using Shape::display;
+		void display(Canvas& canvas, const View& view)
 		{
-			if (ratio != 1.f)
-			{
-				Ellipse *c = new Ellipse(*this);
-				c->homothety(Vec2(0, 0), ratio);
-				c->display(renderer, 1.f);
-				delete c;
-			}
-			else
-			{
-				SDL_SetRenderDrawColor(renderer, m_color.r, m_color.g, m_color.b, 0x00);
-				int w, h;
-				SDL_GetRendererOutputSize(renderer, &w, &h);
-				Vec2 center((w / 2), (h / 2));
-				Vec2 displayableOrigin = m_origin + center;
-				for (int i = -(int)(m_radius.x); i < (int)(m_radius.x); ++i)
-				{
-					for (int j = -(int)(m_radius.y); j < (int)(m_radius.y); ++j)
-					{
-						if (j*j*m_radius.x*m_radius.x + i*i*m_radius.y*m_radius.y <= m_radius.x*m_radius.x*m_radius.y*m_radius.y)
-						{
-							SDL_RenderDrawPoint(renderer, (int)(displayableOrigin.x + i), (int)(displayableOrigin.y + j));
-						}
-					}
-				}
-			}
+			canvas.set_color(m_color);
+			rasterize_ellipse(canvas, view.apply(m_origin), view.scale * m_radius);
 		}
 		/*!
 		Function to serialize the shape into a string
@@ -948,19 +1154,43 @@ namespace Patchwork
 			serial = serial + " " + to_string(m_color.b);
 		}
 		/*!
+		Function to encode the shape into a binary payload
+		*/
+		void encode(std::string& out)
+		{
+			write_byte(out, ELLIPSE);
+			write_varint(out, m_id);
+			write_float(out, m_origin.x);
+			write_float(out, m_origin.y);
+			write_float(out, m_radius.x);
+			write_float(out, m_radius.y);
+			write_color(out, m_color);
+		}
+		/*!
 		Function to compute the boudning box
 		*/
 		BoundingBox bounding_box()
 		{
 			BoundingBox bb;
-			bb.x_min = (int)(m_origin.x - m_radius.x);
-			bb.x_max = (int)(m_origin.x + m_radius.x);
-			bb.y_min = (int)(m_origin.y - m_radius.y);
-			bb.y_max = (int)(m_origin.y + m_radius.y);
+			bb.x_min = m_origin.x - m_radius.x;
+			bb.x_max = m_origin.x + m_radius.x;
+			bb.y_min = m_origin.y - m_radius.y;
+			bb.y_max = m_origin.y + m_radius.y;
 
 			return bb;
 		}
 		/*!
+		Function to tell whether p is inside the ellipse
+		*/
+		bool contains(const Vec2& p)
+		{
+			if (m_radius.x <= 0.f || m_radius.y <= 0.f)
+				return false;
+			float x = (p.x - m_origin.x) / m_radius.x;
+			float y = (p.y - m_origin.y) / m_radius.y;
+			return x * x + y * y <= 1.f;
+		}
+		/*!
 		Out stream operator override
 		*/
 		friend std::ostream& operator<< (std::ostream &out, const Ellipse &Ellipse);
@@ -998,288 +1228,1306 @@ namespace Patchwork
 	}
 
 
-	///////////////////////////////////////////////////////////////////////////////////////////////////////////
-
+	/*!
+	Factory of the shapes an image makes itself, see Image::make
+	*/
+	typedef Factory<Circle, Polygon, Line, Ellipse> ShapeFactory;
 
 	/*!
-	Image class providing functions to make, transform and display a 2D Image composed of 2D shapes.
-	This class is thread safe but it canno't be copied !
-	The image is considered as a rectancle (AABB : Axis Aligned Bounding Box) for the transformations.
+	Structure of arrays storage for shapes, used by Image in packed storage (see Image::pack).
+	Circles, ellipses, lines and polygons each have their own arrays of coordinates, the polygon vertices being kept in one pool
+	shared by every polygon, and the slots keep the painting order with the color, id and version of each shape.
+	Transforms, bounding boxes and drawing are loops over these arrays, without pointer chasing nor virtual calls.
+	Nested images can't be packed. Not thread safe : Image guards it with its mutex.
 	*/
-	class Image : public Shape
+	class Packed
 	{
 	public:
 		/*!
-		Constructor with the origin sets at (0,0) by default, else define the origin of the Image (for Image inside an Image)
-		Initialize the annotation to an empty string and components as empty list
+		A shape in painting order : its type and its position in the arrays of this type
 		*/
-		Image(Vec2 o = { 0, 0 }) : Shape(Shape::IMAGE, Color(0, 0, 0)), annotation(std::string()), components_(std::vector<Shape *>()), origin_(o){}
-		~Image()
+		struct Slot
 		{
-			components_.clear();
-		}
-		//Due to the use of mutex which is not copyable, Image is not copyable either
-		Image(const Image&) = delete;
-		Image& operator=(Image const&) = delete;
+			Shape::Derivedtype type;
+			uint32_t index;
+		};
+		Packed() : vertex_holes_(0) {}
 		/*!
-		Function to compute the area of the image : bounding box defining the rectangle, then simply width*height
+		Number of shapes
 		*/
-		float area()
-		{			
-			BoundingBox bb = bounding_box();
-			std::lock_guard<std::mutex> guard(mutex);
-			int w = bb.x_max - bb.x_min;
-			int h = bb.y_max - bb.y_min;
-			return  (float)w*h;
-		}
+		std::size_t size() const { return slots_.size(); }
 		/*!
-		Function to compute the perimeter of the image : bounding box defining the rectangle, then simply 2*(width+height)
+		Number of shapes of the given type
 		*/
-		float perimeter()
+		std::size_t count(Shape::Derivedtype type) const
 		{
-			BoundingBox bb = bounding_box();
-			std::lock_guard<std::mutex> guard(mutex);
-			int w = bb.x_max - bb.x_min;
-			int h = bb.y_max - bb.y_min;
-			return 2.f*(w+h);
+			switch (type)
+			{
+				case Shape::CIRCLE: return circle_r_.size();
+				case Shape::POLYGON: return polygon_first_.size();
+				case Shape::LINE: return line_dx_.size();
+				case Shape::ELLIPSE: return ellipse_rx_.size();
+				default: return 0;
+			}
 		}
 		/*!
-		Function to translate the image, equivalent to the translation of all its components
+		Remove every shape
 		*/
-		void translate(const Vec2& v)
+		void clear()
 		{
-			std::lock_guard<std::mutex> guard(mutex);
-			for (auto component : components_)
-			{
-				component->translate(v);
-			}
+			slots_.clear();
+			color_.clear();
+			id_.clear();
+			version_.clear();
+			circle_x_.clear(); circle_y_.clear(); circle_r_.clear();
+			ellipse_x_.clear(); ellipse_y_.clear(); ellipse_rx_.clear(); ellipse_ry_.clear();
+			line_x_.clear(); line_y_.clear(); line_dx_.clear(); line_dy_.clear();
+			polygon_first_.clear(); polygon_count_.clear(); vertex_x_.clear(); vertex_y_.clear();
+			vertex_holes_ = 0;
 		}
 		/*!
-		Function to homothety the image, equivalent to the homothety of all its components
+		Getters for the slot, color, id and version of the shape painted at position i
 		*/
-		void homothety(float ratio)
-		{
-			std::lock_guard<std::mutex> guard(mutex);
-			for (auto component : components_)
+		const Slot& slot(std::size_t i) const { return slots_[i]; }
+		const Color& color(std::size_t i) const { return color_[i]; }
+		const std::vector<Color>& colors() const { return color_; }
+		uint32_t id(std::size_t i) const { return id_[i]; }
+		uint32_t version(std::size_t i) const { return version_[i]; }
+		/*!
+		Setter for the version of the shape at position i, or of every shape
+		*/
+		void version(std::size_t i, uint32_t version) { version_[i] = version; }
+		void stamp(uint32_t version) { std::fill(version_.begin(), version_.end(), version); }
+		/*!
+		Append a copy of a shape, which must not be an image, painted after the others
+		*/
+		void add(Shape* s)
+		{
+			Slot slot = { s->type(), 0 };
+			switch (s->type())
 			{
-				component->homothety(ratio);
+				case Shape::CIRCLE:
+				{
+					Circle* c = static_cast<Circle*>(s);
+					slot.index = (uint32_t)circle_r_.size();
+					circle_x_.push_back(c->origin().x);
+					circle_y_.push_back(c->origin().y);
+					circle_r_.push_back(c->radius());
+				}break;
+				case Shape::POLYGON:
+				{
+					Polygon* p = static_cast<Polygon*>(s);
+					slot.index = (uint32_t)polygon_first_.size();
+					polygon_first_.push_back((uint32_t)vertex_x_.size());
+					polygon_count_.push_back((uint32_t)p->points().size());
+					for (auto& point : p->points())
+					{
+						vertex_x_.push_back(point.x);
+						vertex_y_.push_back(point.y);
+					}
+				}break;
+				case Shape::LINE:
+				{
+					Line* l = static_cast<Line*>(s);
+					slot.index = (uint32_t)line_dx_.size();
+					line_x_.push_back(l->point().x);
+					line_y_.push_back(l->point().y);
+					line_dx_.push_back(l->direction().x);
+					line_dy_.push_back(l->direction().y);
+				}break;
+				case Shape::ELLIPSE:
+				{
+					Ellipse* e = static_cast<Ellipse*>(s);
+					slot.index = (uint32_t)ellipse_rx_.size();
+					ellipse_x_.push_back(e->origin().x);
+					ellipse_y_.push_back(e->origin().y);
+					ellipse_rx_.push_back(e->radius().x);
+					ellipse_ry_.push_back(e->radius().y);
+				}break;
+				default:
+					return;
 			}
+			slots_.push_back(slot);
+			color_.push_back(s->color());
+			id_.push_back(s->id());
+			version_.push_back(s->version());
 		}
 		/*!
-		Function to homothety the image, equivalent to the homothety of all its components
+		Remove the shape painted at position i.
+		The last shape of its type takes its place in the arrays, and the vertices of a polygon are left as a hole in the pool,
+		which is compacted once the holes outnumber the vertices in use : only the painting order is shifted.
 		*/
-		void homothety(const Vec2& p, float ratio)
+		void remove(std::size_t i)
 		{
-			std::lock_guard<std::mutex> guard(mutex);
-			for (auto component : components_)
+			Slot removed = slots_[i];
+			uint32_t k = removed.index;
+			uint32_t last = (uint32_t)count(removed.type) - 1;
+			switch (removed.type)
+			{
+				case Shape::CIRCLE: move_last(k, circle_x_, circle_y_, circle_r_); break;
+				case Shape::LINE: move_last(k, line_x_, line_y_, line_dx_, line_dy_); break;
+				case Shape::ELLIPSE: move_last(k, ellipse_x_, ellipse_y_, ellipse_rx_, ellipse_ry_); break;
+				case Shape::POLYGON:
+				{
+					vertex_holes_ += polygon_count_[k];
+					move_last(k, polygon_first_, polygon_count_);
+				}break;
+				default: return;
+			}
+			erase_at(i, slots_, color_, id_, version_);
+			if (k != last)
 			{
-				component->homothety(p, ratio);
+				for (auto& slot : slots_)
+				{
+					if (slot.type == removed.type && slot.index == last)
+					{
+						slot.index = k;
+						break;
+					}
+				}
 			}
+			if (vertex_holes_ > vertex_x_.size() / 2)
+				compact();
 		}
 		/*!
-		Function to compute the rotation the image, equivalent to the rotation of all its components
+		Make a shape in the factory from the one painted at position i, with its id and version
 		*/
-		void rotate(float angle)
+		Shape* make(std::size_t i, ShapeFactory& factory) const
 		{
-			std::lock_guard<std::mutex> guard(mutex);
-			for (auto component : components_)
+			Shape* s = nullptr;
+			uint32_t k = slots_[i].index;
+			switch (slots_[i].type)
 			{
-				component->rotate(angle);
+				case Shape::CIRCLE: s = factory.make<Circle>(Vec2(circle_x_[k], circle_y_[k]), circle_r_[k], color_[i]); break;
+				case Shape::POLYGON: s = factory.make<Polygon>(points(k), color_[i]); break;
+				case Shape::LINE: s = factory.make<Line>(Vec2(line_x_[k], line_y_[k]), Vec2(line_dx_[k], line_dy_[k]), color_[i]); break;
+				case Shape::ELLIPSE: s = factory.make<Ellipse>(Vec2(ellipse_x_[k], ellipse_y_[k]), Vec2(ellipse_rx_[k], ellipse_ry_[k]), color_[i]); break;
+				default: return nullptr;
 			}
+			s->m_id = id_[i];
+			s->m_version = version_[i];
+			return s;
 		}
 		/*!
-		Function to compute the rotation the image, equivalent to the rotation of all its components
+		Call f with a temporary shape holding the one painted at position i, for the rare operations without a batched loop
+		(serialization, hit testing)
 		*/
-		void rotate(const Vec2& p, double angle)
+		template <typename F>
+		void visit(std::size_t i, F f) const
 		{
-			std::lock_guard<std::mutex> guard(mutex);
-			for (auto component : components_)
+			uint32_t k = slots_[i].index;
+			switch (slots_[i].type)
 			{
-				component->rotate(p, angle);
+				case Shape::CIRCLE:
+				{
+					Circle s(Vec2(circle_x_[k], circle_y_[k]), circle_r_[k], color_[i]);
+					call(s, i, f);
+				}break;
+				case Shape::POLYGON:
+				{
+					Polygon s(points(k), color_[i]);
+					call(s, i, f);
+				}break;
+				case Shape::LINE:
+				{
+					Line s(Vec2(line_x_[k], line_y_[k]), Vec2(line_dx_[k], line_dy_[k]), color_[i]);
+					call(s, i, f);
+				}break;
+				case Shape::ELLIPSE:
+				{
+					Ellipse s(Vec2(ellipse_x_[k], ellipse_y_[k]), Vec2(ellipse_rx_[k], ellipse_ry_[k]), color_[i]);
+					call(s, i, f);
+				}break;
+				default: break;
 			}
 		}
 		/*!
-		Function to compute the central symetry of the image, equivalent to the central symetry of all its components
+		Bounding box of every shape, empty without shapes
 		*/
-		void centralSym(const Vec2& c)
+		BoundingBox bounding_box() const
 		{
-			std::lock_guard<std::mutex> guard(mutex);
-			for (auto component : components_)
+			BoundingBox bb;
+			for (std::size_t k = 0; k < circle_r_.size(); ++k)
 			{
-				component->centralSym(c);
+				bb.x_min = std::min(bb.x_min, circle_x_[k] - circle_r_[k]);
+				bb.x_max = std::max(bb.x_max, circle_x_[k] + circle_r_[k]);
+				bb.y_min = std::min(bb.y_min, circle_y_[k] - circle_r_[k]);
+				bb.y_max = std::max(bb.y_max, circle_y_[k] + circle_r_[k]);
+			}
+			for (std::size_t k = 0; k < ellipse_rx_.size(); ++k)
+			{
+				bb.x_min = std::min(bb.x_min, ellipse_x_[k] - ellipse_rx_[k]);
+				bb.x_max = std::max(bb.x_max, ellipse_x_[k] + ellipse_rx_[k]);
+				bb.y_min = std::min(bb.y_min, ellipse_y_[k] - ellipse_ry_[k]);
+				bb.y_max = std::max(bb.y_max, ellipse_y_[k] + ellipse_ry_[k]);
+			}
+			for (std::size_t k = 0; k < line_dx_.size(); ++k)
+			{
+				bb.x_min = std::min(bb.x_min, std::min(line_x_[k], line_x_[k] + line_dx_[k]));
+				bb.x_max = std::max(bb.x_max, std::max(line_x_[k], line_x_[k] + line_dx_[k]));
+				bb.y_min = std::min(bb.y_min, std::min(line_y_[k], line_y_[k] + line_dy_[k]));
+				bb.y_max = std::max(bb.y_max, std::max(line_y_[k], line_y_[k] + line_dy_[k]));
+			}
+			//Every vertex of every polygon at once, unless removed polygons left holes in the pool
+			if (vertex_holes_ == 0)
+			{
+				for (std::size_t v = 0; v < vertex_x_.size(); ++v)
+				{
+					bb.x_min = std::min(bb.x_min, vertex_x_[v]);
+					bb.x_max = std::max(bb.x_max, vertex_x_[v]);
+					bb.y_min = std::min(bb.y_min, vertex_y_[v]);
+					bb.y_max = std::max(bb.y_max, vertex_y_[v]);
+				}
+			}
+			else
+			{
+				for (uint32_t k = 0; k < polygon_first_.size(); ++k)
+					bb.merge(polygon_box(k));
 			}
+			return bb;
 		}
 		/*!
-		Function to compute the axial symetry of the image, equivalent to the axial symetry of all its components
+		Bounding box of the shape painted at position i, as the bounding_box function of its class computes it
 		*/
-		void axialSym(const Vec2& p, const Vec2& d)
+		BoundingBox bounding_box(std::size_t i) const
 		{
-			std::lock_guard<std::mutex> guard(mutex);
-			for (auto component : components_)
+			BoundingBox bb;
+			uint32_t k = slots_[i].index;
+			switch (slots_[i].type)
 			{
-				component->axialSym(p, d);
+				case Shape::CIRCLE:
+				{
+					bb.x_min = circle_x_[k] - circle_r_[k];
+					bb.x_max = circle_x_[k] + circle_r_[k];
+					bb.y_min = circle_y_[k] - circle_r_[k];
+					bb.y_max = circle_y_[k] + circle_r_[k];
+				}break;
+				case Shape::POLYGON:
+				{
+					bb = polygon_box(k);
+				}break;
+				case Shape::LINE:
+				{
+					bb.x_min = std::min(line_x_[k], line_x_[k] + line_dx_[k]);
+					bb.x_max = std::max(line_x_[k], line_x_[k] + line_dx_[k]);
+					bb.y_min = std::min(line_y_[k], line_y_[k] + line_dy_[k]);
+					bb.y_max = std::max(line_y_[k], line_y_[k] + line_dy_[k]);
+				}break;
+				case Shape::ELLIPSE:
+				{
+					bb.x_min = ellipse_x_[k] - ellipse_rx_[k];
+					bb.x_max = ellipse_x_[k] + ellipse_rx_[k];
+					bb.y_min = ellipse_y_[k] - ellipse_ry_[k];
+					bb.y_max = ellipse_y_[k] + ellipse_ry_[k];
+				}break;
+				default: break;
 			}
+			return bb;
 		}
 		/*!
-		Function to compute the bounding box
+		Apply to every shape the homothety of ratio around its own center, as their homothety functions do (none for lines)
 		*/
-		BoundingBox bounding_box()
+		void homothety(float ratio)
 		{
-			std::lock_guard<std::mutex> guard(mutex);
-			BoundingBox bb_ = {};
-			BoundingBox bb = {};
-			for (auto component : components_)
+			scale(circle_r_, ratio);
+			scale(ellipse_rx_, ratio);
+			scale(ellipse_ry_, ratio);
+			for (std::size_t k = 0; k < polygon_first_.size(); ++k)
 			{
-				bb = component->bounding_box();
-				if (bb_.x_max < bb.x_max)
-					bb_.x_max = bb.x_max;
-				if (bb_.x_min > bb.x_min)
-					bb_.x_min = bb.x_min;
-				if (bb_.y_max < bb.y_max)
-					bb_.y_max = bb.y_max;
-				if (bb_.y_min > bb.y_min)
-					bb_.y_min = bb.y_min;
+				BoundingBox bb = polygon_box(k);
+				Vec2 center = Vec2(bb.x_max - ((bb.x_max - bb.x_min) / 2.f), bb.y_max - ((bb.y_max - bb.y_min) / 2.f));
+				Simd::transform(Affine::homothety(center, ratio), vertex_x_.data() + polygon_first_[k], vertex_y_.data() + polygon_first_[k], polygon_count_[k]);
 			}
-			return bb_;
 		}
 		/*!
-		Function to add a component to the image
+		Rotate every shape by angle, as their rotate functions do : polygon vertices around the origin,
+		line directions around their point, nothing for circles and ellipses
 		*/
-		void add_component(Shape* s)
-		{ 
-			std::lock_guard<std::mutex> guard(mutex);
-			s->translate(origin_);
-			components_.push_back(s); 
+		void rotate(float angle)
+		{
+			float s = fast_sin(angle);
+			float c = fast_cos(angle);
+			apply(Affine::rotation(Vec2(0, 0), angle), vertex_x_, vertex_y_);
+			for (std::size_t k = 0; k < line_dx_.size(); ++k)
+			{
+				float x = (line_dx_[k] * c - line_dy_[k] * s);
+				float y = (line_dx_[k] * s + line_dy_[k] * c);
+				line_dx_[k] = x;
+				line_dy_[k] = y;
+			}
 		}
 		/*!
-		Getter for the origin 
+		Apply the central symetry of center p to every shape, as their centralSym functions do (lines only move their point)
 		*/
-		Vec2 origin() const
+		void centralSym(const Vec2& p)
 		{
-			return origin_;
+			scale(circle_x_, circle_y_, p, -1.f);
+			scale(ellipse_x_, ellipse_y_, p, -1.f);
+			scale(line_x_, line_y_, p, -1.f);
+			apply(Affine::central_symmetry(p), vertex_x_, vertex_y_);
 		}
 		/*!
-		Setter for the origin
+		Apply the axial symetry of the line (p, d) to every shape, as their axialSym functions do (none for lines)
 		*/
-		void origin( Vec2 new_origin)
+		void axialSym(const Vec2& p, const Vec2& d)
 		{
-			Vec2 v = (origin_ - new_origin);
-			translate(v);
-			origin_ = new_origin;
+			reflect(circle_x_, circle_y_, p, d);
+			reflect(ellipse_x_, ellipse_y_, p, d);
+			apply(Affine::axial_symmetry(p, d), vertex_x_, vertex_y_);
 		}
 		/*!
-		Function to display the shape. Equivalent to displaying all its components.
+		Apply an affine transform to every shape, as their transform functions do : shapes to the circles, polygons and lines,
+		ellipses to the ellipses (see Image::flatten)
 		*/
-		void display(SDL_Renderer* renderer, float ratio)
+		void transform(const Affine& shapes, const Affine& ellipses)
 		{
-			std::lock_guard<std::mutex> guard(mutex);
-			for (auto component : components_)
+			apply(shapes, circle_x_, circle_y_);
+			scale(circle_r_, shapes.scale());
+			apply(shapes, vertex_x_, vertex_y_);
+			apply(ellipses, ellipse_x_, ellipse_y_);
+			scale(ellipse_rx_, ellipses.scale());
+			scale(ellipse_ry_, ellipses.scale());
+			apply(shapes, line_x_, line_y_);
+			for (std::size_t k = 0; k < line_dx_.size(); ++k)
 			{
-				component->display(renderer, ratio);
+				Vec2 d = Line::turn(shapes, Vec2(line_dx_[k], line_dy_[k]));
+				line_dx_[k] = d.x;
+				line_dy_[k] = d.y;
 			}
 		}
 		/*!
-		Function to display the image. This is called on the Image we actually want to display. It compute a ratio to be able to fit every shapes in the fixed size displayable texture.
-		If the shapes need to be resized, a ratio is passed to the display function.
+		Draw the shape painted at position i through the view, as the display function of its class does
 		*/
-		void display(SDL_Renderer* renderer)
+		void display(std::size_t i, Canvas& canvas, const View& view) const
 		{
-			BoundingBox bb = bounding_box();
-			std::lock_guard<std::mutex> guard(mutex);
+			uint32_t k = slots_[i].index;
+			canvas.set_color(color_[i]);
+			switch (slots_[i].type)
+			{
+				case Shape::CIRCLE:
+				{
+					rasterize_circle(canvas, view.apply(Vec2(circle_x_[k], circle_y_[k])), view.scale * circle_r_[k]);
+				}break;
+				case Shape::POLYGON:
+				{
+					std::vector<Vec2>& points = Raster::scratch().points;
+					points.clear();
+					BoundingBox bb;
+					for (uint32_t v = polygon_first_[k]; v < polygon_first_[k] + polygon_count_[k]; ++v)
+					{
+						Vec2 p(view.scale * vertex_x_[v], view.scale * vertex_y_[v]);
+						points.push_back(p);
+						bb.x_min = std::min(bb.x_min, p.x);
+						bb.x_max = std::max(bb.x_max, p.x);
+						bb.y_min = std::min(bb.y_min, p.y);
+						bb.y_max = std::max(bb.y_max, p.y);
+					}
+					rasterize_polygon(canvas, points, view.offset, (int)bb.x_min - 1, (int)bb.x_max + 1, (int)bb.y_min - 1, (int)bb.y_max + 1);
+				}break;
+				case Shape::LINE:
+				{
+					//A line is drawn unscaled, only the offset of the view applies
+					float x = line_x_[k] + view.offset.x, y = line_y_[k] + view.offset.y;
+					canvas.line((int)x, (int)y, (int)(x + line_dx_[k]), (int)(y + line_dy_[k]));
+				}break;
+				case Shape::ELLIPSE:
+				{
+					rasterize_ellipse(canvas, view.apply(Vec2(ellipse_x_[k], ellipse_y_[k])), view.scale * Vec2(ellipse_rx_[k], ellipse_ry_[k]));
+				}break;
+				default: break;
+			}
+		}
 
-			int w, h;
-			SDL_GetRendererOutputSize(renderer, &w, &h);
-			Vec2 center((w / 2), (h / 2));
-			bb.x_max = bb.x_max + center.x;
-			bb.x_min = bb.x_min + center.x;
-			bb.y_max = bb.y_max + center.y;
-			bb.y_min = bb.y_min + center.y;
-			Vec2 v1 = (center - Vec2( bb.x_max, bb.y_max ));
-			Vec2 v2 = (center - Vec2(bb.x_min, bb.y_min));
-			int im_w, im_h;
-			float n1 = norm(v1);
-			float n2 = norm(v2);
-			if (norm(v1) > norm(v2))
+	private:
+		/*!
+		Give the temporary shape of visit the id and version of the slot i, then call f with it
+		*/
+		template <typename F>
+		void call(Shape& s, std::size_t i, F& f) const
+		{
+			s.m_id = id_[i];
+			s.m_version = version_[i];
+			f(s);
+		}
+		/*!
+		Vertices of the polygon k
+		*/
+		std::vector<Vec2> points(uint32_t k) const
+		{
+			std::vector<Vec2> points;
+			points.reserve(polygon_count_[k]);
+			for (uint32_t v = polygon_first_[k]; v < polygon_first_[k] + polygon_count_[k]; ++v)
+				points.push_back(Vec2(vertex_x_[v], vertex_y_[v]));
+			return points;
+		}
+		/*!
+		Bounding box of the polygon k
+		*/
+		BoundingBox polygon_box(uint32_t k) const
+		{
+			BoundingBox bb;
+			for (uint32_t v = polygon_first_[k]; v < polygon_first_[k] + polygon_count_[k]; ++v)
 			{
-				im_w = n1 * 2;
-				im_h = im_w;
+				bb.x_min = std::min(bb.x_min, vertex_x_[v]);
+				bb.x_max = std::max(bb.x_max, vertex_x_[v]);
+				bb.y_min = std::min(bb.y_min, vertex_y_[v]);
+				bb.y_max = std::max(bb.y_max, vertex_y_[v]);
 			}
-			else
+			return bb;
+		}
+		/*!
+		Apply m to the points (x, y), several at once (see Simd.h)
+		*/
+		static void apply(const Affine& m, std::vector<float>& x, std::vector<float>& y)
+		{
+			Simd::transform(m, x.data(), y.data(), x.size());
+		}
+		static void scale(std::vector<float>& a, float ratio)
+		{
+			for (auto& x : a)
+				x *= ratio;
+		}
+		/*!
+		Move the points (x, y) to p + ratio * (point - p)
+		*/
+		static void scale(std::vector<float>& x, std::vector<float>& y, const Vec2& p, float ratio)
+		{
+			for (std::size_t k = 0; k < x.size(); ++k)
 			{
-				im_w = n2 * 2;
-				im_h = im_w;
+				x[k] = p.x + ratio * (x[k] - p.x);
+				y[k] = p.y + ratio * (y[k] - p.y);
 			}
-
-			float w_ratio = (float) w / im_w;
-			float h_ratio = (float) h / im_h;
-			float final_ratio = 1.f;
-
-			if (w_ratio < 1.f || h_ratio < 1.f)
+		}
+		/*!
+		Reflect the points (x, y) across the line passing by p with the direction d
+		*/
+		static void reflect(std::vector<float>& x, std::vector<float>& y, const Vec2& p, const Vec2& d)
+		{
+			float length = d.x * d.x + d.y * d.y;
+			for (std::size_t k = 0; k < x.size(); ++k)
 			{
-				if (w_ratio <= h_ratio)
-				{
-					final_ratio = w_ratio;
-				}
-				else
-				{
-					final_ratio = h_ratio;
-				}
+				float b = ((x[k] - p.x) * d.x + (y[k] - p.y) * d.y) / length;
+				x[k] = 2.f * (p.x + b * d.x) - x[k];
+				y[k] = 2.f * (p.y + b * d.y) - y[k];
 			}
-
-			for (auto component : components_)
+		}
+		/*!
+		Erase the element i of every vector
+		*/
+		template <typename... V>
+		static void erase_at(std::size_t i, V&... v)
+		{
+			int expand[] = { (v.erase(v.begin() + i), 0)... };
+			(void)expand;
+		}
+		/*!
+		Remove the element i of every vector by moving the last one in its place
+		*/
+		template <typename... V>
+		static void move_last(std::size_t i, V&... v)
+		{
+			int expand[] = { (v[i] = v.back(), v.pop_back(), 0)... };
+			(void)expand;
+		}
+		/*!
+		Move the vertices of every polygon next to each other again, dropping the holes left by the removed polygons
+		*/
+		void compact()
+		{
+			std::size_t next = 0;
+			std::vector<uint32_t> order(polygon_first_.size());
+			for (uint32_t k = 0; k < order.size(); ++k)
+				order[k] = k;
+			//In the order of the pool, each range only moves down, over the holes
+			std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return polygon_first_[a] < polygon_first_[b]; });
+			for (uint32_t k : order)
 			{
-
-				component->display(renderer, final_ratio);
+				uint32_t first = polygon_first_[k];
+				std::copy(vertex_x_.begin() + first, vertex_x_.begin() + first + polygon_count_[k], vertex_x_.begin() + next);
+				std::copy(vertex_y_.begin() + first, vertex_y_.begin() + first + polygon_count_[k], vertex_y_.begin() + next);
+				polygon_first_[k] = (uint32_t)next;
+				next += polygon_count_[k];
 			}
+			vertex_x_.resize(next);
+			vertex_y_.resize(next);
+			vertex_holes_ = 0;
 		}
 
+		std::vector<Slot> slots_; /*!< Every shape in painting order */
+		std::vector<Color> color_; /*!< Color of each slot */
+		std::vector<uint32_t> id_; /*!< Id of each slot */
+		std::vector<uint32_t> version_; /*!< Version of each slot */
+		std::vector<float> circle_x_, circle_y_, circle_r_; /*!< Circles centers and radii */
+		std::vector<float> ellipse_x_, ellipse_y_, ellipse_rx_, ellipse_ry_; /*!< Ellipses centers and radii */
+		std::vector<float> line_x_, line_y_, line_dx_, line_dy_; /*!< Lines points and directions */
+		std::vector<uint32_t> polygon_first_, polygon_count_; /*!< Range of each polygon in the vertex pool */
+		std::vector<float> vertex_x_, vertex_y_; /*!< Vertex pool shared by every polygon */
+		std::size_t vertex_holes_; /*!< Vertices of the removed polygons still in the pool, see compact */
+	};
+
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+
+	/*!
+	Image class providing functions to make, transform and display a 2D Image composed of 2D shapes.
+	This class is thread safe but it canno't be copied !
+	The image is considered as a rectancle (AABB : Axis Aligned Bounding Box) for the transformations.
+	Every edit increments the image version and stamps the edited shape with it, and every shape gets an id, increasing in components order.
+	This lets an image send only what changed since the version its peer acknowledged (see serialize_delta).
+	The components can be indexed by their bounding box (see enable_index) to answer region and point queries without a linear scan,
+	or packed in arrays (see pack) for images of many shapes.
+	Translations, rotations and homotheties around a point are composed into a pending transform instead of moving every component (see flatten).
+	The shapes the image makes itself, when deserializing or through make, are kept in pools released at once when the image is replaced or destroyed.
+	*/
+	class Image : public Shape
+	{
+	public:
 		/*!
-		Getter for the image' annotation
+		Constructor with the origin sets at (0,0) by default, else define the origin of the Image (for Image inside an Image)
+		Initialize the annotation to an empty string and components as empty list
 		*/
-		std::string get_annotation()
+		Image(Vec2 o = { 0, 0 }) : Shape(Shape::IMAGE, Color(0, 0, 0)), annotation(std::string()), components_(std::vector<Shape *>()), origin_(o),
+			version_(0), received_version_(0), acked_version_(0), annotation_version_(0), next_id_(1), revision_(next_revision()), cache_revision_(0), index_dirty_(false), bbox_valid_(false), bbox_nested_revision_(0), packed_storage_(false), pending_active_(false), pending_version_(0){}
+		~Image()
 		{
-			std::lock_guard<std::mutex> guard(mutex);
-			return annotation;
+			components_.clear();
 		}
+		//Due to the use of mutex which is not copyable, Image is not copyable either
+		Image(const Image&) = delete;
+		Image& operator=(Image const&) = delete;
 		/*!
-		Setter for the image' annotation
+		Function to compute the area of the image : bounding box defining the rectangle, then simply width*height
 		*/
-		void annotate(std::string msg)
+		float area()
+		{			
+			BoundingBox bb = bounding_box();
+			if (bb.empty())
+				return 0.f;
+			return (bb.x_max - bb.x_min) * (bb.y_max - bb.y_min);
+		}
+		/*!
+		Function to compute the perimeter of the image : bounding box defining the rectangle, then simply 2*(width+height)
+		*/
+		float perimeter()
+		{
+			BoundingBox bb = bounding_box();
+			if (bb.empty())
+				return 0.f;
+			return 2.f*((bb.x_max - bb.x_min) + (bb.y_max - bb.y_min));
+		}
+		/*!
+		Function to translate the image, equivalent to the translation of all its components.
+		Only composed into the pending transform, see flatten.
+		*/
+		void translate(const Vec2& v)
 		{
 			std::lock_guard<std::mutex> guard(mutex);
-			annotation = msg;
+			Affine m = Affine::translation(v);
+			compose_locked(m, m);
 		}
 		/*!
-		Function to serialize the image into string, equivalent to serialize all of its components
+		Function to homothety the image, equivalent to the homothety of all its components
 		*/
-		void serialize(std::string& serial)
+		void homothety(float ratio)
 		{
 			std::lock_guard<std::mutex> guard(mutex);
+			flatten_locked();
+			++version_;
+			touch();
+			index_dirty_ = true;
+			bbox_valid_ = false;
+			packed_.homothety(ratio);
+			packed_.stamp(version_);
 			for (auto component : components_)
 			{
-				component->serialize(serial);
+				component->homothety(ratio);
+				component->m_version = version_;
 			}
-			serial = serial + " annotation " + to_string((int)annotation.size()) + " " + annotation;
 		}
 		/*!
-		Function to deserialize a string into an image.
-		/!\ this function erase all existing components /!\
+		Function to homothety the image around p, equivalent to the homothety of all its components.
+		Only composed into the pending transform, see flatten.
 		*/
-		void deserialize(std::string s)
+		void homothety(const Vec2& p, float ratio)
 		{
-			components_.clear();
-			std::istringstream buf(s);
-			for (std::string word; buf >> word;)
+			std::lock_guard<std::mutex> guard(mutex);
+			Affine m = Affine::homothety(p, ratio);
+			compose_locked(m, m);
+		}
+		/*!
+		Function to compute the rotation the image, equivalent to the rotation of all its components
+		*/
+		void rotate(float angle)
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			flatten_locked();
+			++version_;
+			touch();
+			index_dirty_ = true;
+			bbox_valid_ = false;
+			packed_.rotate(angle);
+			packed_.stamp(version_);
+			for (auto component : components_)
 			{
-				switch (Shape::ShapeStringToEnum(word))
-				{
-					case Shape::CIRCLE:
-					{
-						try
-						{
-							buf >> word;
-							float x = std::stof(word);
-							buf >> word;
+				component->rotate(angle);
+				component->m_version = version_;
+			}
+		}
+		/*!
+		Function to compute the rotation the image around p, equivalent to the rotation of all its components.
+		Only composed into the pending transform, see flatten.
+		*/
+		void rotate(const Vec2& p, double angle)
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			Affine m = Affine::rotation(p, angle);
+			compose_locked(m, Affine());
+		}
+		/*!
+		Function to compute the central symetry of the image, equivalent to the central symetry of all its components
+		*/
+		void centralSym(const Vec2& c)
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			flatten_locked();
+			++version_;
+			touch();
+			index_dirty_ = true;
+			bbox_valid_ = false;
+			packed_.centralSym(c);
+			packed_.stamp(version_);
+			for (auto component : components_)
+			{
+				component->centralSym(c);
+				component->m_version = version_;
+			}
+		}
+		/*!
+		Function to compute the axial symetry of the image, equivalent to the axial symetry of all its components
+		*/
+		void axialSym(const Vec2& p, const Vec2& d)
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			flatten_locked();
+			++version_;
+			touch();
+			index_dirty_ = true;
+			bbox_valid_ = false;
+			packed_.axialSym(p, d);
+			packed_.stamp(version_);
+			for (auto component : components_)
+			{
+				component->axialSym(p, d);
+				component->m_version = version_;
+			}
+		}
+		/*!
+		Function to apply the affine transform m to the image, equivalent to the transform of all its components.
+		Only composed into the pending transform, see flatten.
+		*/
+		void transform(const Affine& m)
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			compose_locked(m, m);
+		}
+		/*!
+		Function to apply the pending transform to the components.
+		translate, homothety and rotate around a point, transform and the origin setter only compose their transform into the pending one,
+		in constant time whatever the number of components. It is applied in a single pass by the next edit, query or serialization, or by the next
+		display unless it is a translation, which is drawn by moving the view instead. As with their own functions, lines keep their length and ellipses get no rotation.
+		*/
+		void flatten()
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			flatten_locked();
+		}
+		/*!
+		Function to get the bounding box, empty without components.
+		It is kept in cache : grown by add_component, moved by a pending translation, and only computed again, on the next call,
+		after an edit which may shrink it (a removal touching it, mark_changed, the other transforms) or an edit of a nested image.
+		*/
+		BoundingBox bounding_box()
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			Vec2 shift;
+			if (!pending_shift(shift))
+				flatten_locked();
+			uint64_t nested = nested_revision();
+			if (!bbox_valid_ || nested != bbox_nested_revision_)
+			{
+				bbox_ = packed_.bounding_box();
+				for (auto component : components_)
+					bbox_.merge(component->bounding_box());
+				bbox_valid_ = true;
+				bbox_nested_revision_ = nested;
+			}
+			if (!pending_active_ || bbox_.empty())
+				return bbox_;
+			BoundingBox bb = bbox_;
+			bb.x_min += shift.x;
+			bb.x_max += shift.x;
+			bb.y_min += shift.y;
+			bb.y_max += shift.y;
+			return bb;
+		}
+		/*!
+		Function to make a shape of type T in the pools of the image, to be added to it right away with add_component.
+		The image releases it when removing it and when it is replaced or destroyed, and the next shapes are made in the same memory.
+		The shapes made with new are always left to their owner (see add_component).
+		*/
+		template <typename T, typename... Args>
+		T* make(Args&&... args)
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			return factory_.make<T>(std::forward<Args>(args)...);
+		}
+		/*!
+		Function to add a component to the image, return the id the image gave it.
+		Whatever the storage, a shape made with new stays its owner's, to delete once the image no longer uses it, and a shape made with make
+		belongs to the image. When packed, the image stores a copy and is done with the shape right away (one made with make is released) :
+		the pointer no longer designates the component, which is reached through components() or its id.
+		*/
+		uint32_t add_component(Shape* s)
+		{ 
+			std::lock_guard<std::mutex> guard(mutex);
+			return add_component_locked(s);
+		}
+		/*!
+		Function to remove the component at index from the image, the removal is remembered until the peer acknowledges it.
+		Throw std::out_of_range if there is no such component.
+		*/
+		void remove_component(int index)
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			flatten_locked();
+			if (packed_storage_)
+			{
+				if (index < 0 || (std::size_t)index >= packed_.size())
+					throw std::out_of_range("remove_component");
+				removed_.push_back(std::make_pair(packed_.id(index), ++version_));
+				if (bbox_valid_ && touches_edge(packed_.bounding_box(index)))
+					bbox_valid_ = false;
+				packed_.remove(index);
+				touch();
+				return;
+			}
+			Shape* s = components_.at(index);
+			removed_.push_back(std::make_pair(s->m_id, ++version_));
+			components_.erase(components_.begin() + index);
+			index_remove(s);
+			forget_nested(s);
+			if (bbox_valid_ && touches_edge(s->bounding_box()))
+				bbox_valid_ = false;
+			release(s);
+			touch();
+		}
+		/*!
+		Function to tell the image that the component at index has been modified directly (through components()).
+		Throw std::out_of_range if there is no such component.
+		*/
+		void mark_changed(int index)
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			flatten_locked();
+			if (packed_storage_)
+			{
+				if (index < 0 || (std::size_t)index >= packed_.size())
+					throw std::out_of_range("mark_changed");
+				packed_.version(index, ++version_);
+				bbox_valid_ = false;
+				touch();
+				return;
+			}
+			Shape* s = components_.at(index);
+			s->m_version = ++version_;
+			index_remove(s);
+			index_insert(s);
+			bbox_valid_ = false;
+			touch();
+		}
+		/*!
+		Function to index the components by their bounding box in a uniform grid of cell_size cells, or to rebuild the index with another cell size.
+		The index is kept up to date by add_component, remove_component, mark_changed, the transforms (a translation only moves it)
+		and the deserialization, then used by query, component_at and the display functions to skip the components out of sight.
+		Lines and nested images are not in the grid : a line is drawn unscaled and a nested image can change without telling,
+		so they are always looked at.
+		*/
+		void enable_index(float cell_size = 64.f)
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			index_.reset(new Grid<Shape>(cell_size));
+			index_dirty_ = true;
+		}
+		/*!
+		Function to drop the index of the components, queries scan the components again
+		*/
+		void disable_index()
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			index_.reset();
+			unindexed_.clear();
+			candidates_.clear();
+		}
+		/*!
+		Getter telling whether the components are indexed (see enable_index)
+		*/
+		bool indexed()
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			return index_ != nullptr;
+		}
+		/*!
+		Function to get the components whose bounding box overlaps the region, in painting order.
+		Uses the index when enabled, else scans the components.
+		*/
+		std::vector<Shape*> query(const BoundingBox& region)
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			flatten_locked();
+			std::vector<Shape*> found;
+			gather(region.x_min, region.y_min, region.x_max, region.y_max, found);
+			found.erase(std::remove_if(found.begin(), found.end(), [&](Shape* s)
+			{
+				BoundingBox bb = s->bounding_box();
+				return bb.x_max < region.x_min || bb.x_min > region.x_max || bb.y_max < region.y_min || bb.y_min > region.y_max;
+			}), found.end());
+			return found;
+		}
+		/*!
+		Function to get the component painted last under the point p (a nested image when p is on one of its components), nullptr if none.
+		Uses the index when enabled, else scans the components.
+		*/
+		Shape* component_at(const Vec2& p)
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			flatten_locked();
+			std::vector<Shape*> found;
+			gather(p.x, p.y, p.x, p.y, found);
+			for (auto it = found.rbegin(); it != found.rend(); ++it)
+			{
+				if ((*it)->contains(p))
+					return *it;
+			}
+			return nullptr;
+		}
+		/*!
+		Function to tell whether p is on one of the components
+		*/
+		bool contains(const Vec2& p)
+		{
+			return component_at(p) != nullptr;
+		}
+		/*!
+		Function to move the components into packed storage (see Packed) : circles, ellipses, lines and polygon vertices in contiguous arrays,
+		which the transforms, bounding_box, the display functions and the serialization go through with loops instead of virtual calls.
+		The components are copied with their id and version, then released as by add_component. Return false, changing nothing, if one of them is a nested image.
+		While packed, components() is empty, remove_component and mark_changed take the position in painting order,
+		added shapes are copied, adding a nested image unpacks the image, and the index, query and component_at
+		only see the shapes stored as pointers.
+		*/
+		bool pack()
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			flatten_locked();
+			return pack_locked();
+		}
+		/*!
+		Function to move the components back out of packed storage, as shapes made in the pools of the image listed by components()
+		*/
+		void unpack()
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			flatten_locked();
+			unpack_locked();
+		}
+		/*!
+		Getter telling whether the components are packed (see pack)
+		*/
+		bool packed()
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			return packed_storage_;
+		}
+		/*!
+		Function to count the shapes of each type and of each color, nested images included (but not counted themselves)
+		*/
+		void tally(std::map<Derivedtype, int>& shapes_count, std::map<Color, int>& color_count)
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			for (auto component : components_)
+			{
+				if (component->type() == IMAGE)
+				{
+					static_cast<Image*>(component)->tally(shapes_count, color_count);
+					continue;
+				}
+				shapes_count[component->type()]++;
+				color_count[component->color()]++;
+			}
+			//Packed shapes are counted by type from the size of their arrays
+			for (int type = CIRCLE; type < IMAGE; ++type)
+			{
+				if (packed_.count((Derivedtype)type))
+					shapes_count[(Derivedtype)type] += (int)packed_.count((Derivedtype)type);
+			}
+			for (auto& color : packed_.colors())
+				color_count[color]++;
+		}
+		/*!
+		Getter for the version of the image, incremented on every edit
+		*/
+		uint32_t current_version()
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			return version_;
+		}
+		/*!
+		Getter for the version of the peer's image this image was last synchronized to by a binary payload, 0 if none was received
+		*/
+		uint32_t received_version()
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			return received_version_;
+		}
+		/*!
+		Function to record that the peer now holds the given version : later deltas will start from it and older removals are forgotten.
+		A version older than the one acknowledged before means the peer ignored a delta : the removals since its version may be forgotten already,
+		so nothing counts as acknowledged anymore and the next payload is the whole image.
+		*/
+		void acknowledge(uint32_t version)
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			if (version < acked_version_)
+			{
+				acked_version_ = 0;
+				return;
+			}
+			if (version == acked_version_ || version > version_)
+				return;
+			acked_version_ = version;
+			removed_.erase(std::remove_if(removed_.begin(), removed_.end(),
+				[version](const std::pair<uint32_t, uint32_t>& r) { return r.second <= version; }), removed_.end());
+		}
+		/*!
+		Getter for the revision of what the image looks like, the latest of its own and of its nested images.
+		Revisions come from a counter shared by every image, so any edit of the image or of a nested image gives a greater one.
+		*/
+		uint64_t revision()
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			return std::max(revision_, nested_revision());
+		}
+		/*!
+		Getter for the origin 
+		*/
+		Vec2 origin() const
+		{
+			return origin_;
+		}
+		/*!
+		Setter for the origin
+		*/
+		void origin( Vec2 new_origin)
+		{
+			Vec2 v = (origin_ - new_origin);
+			translate(v);
+			origin_ = new_origin;
+		}
+		/*!
+		Function to display the shape. Equivalent to displaying all its components, except the ones outside of the canvas which are skipped (culled)
+		and the ones smaller than a pixel which are drawn as a single pixel (collapsed), nested images included. See Canvas::counters.
+		*/
+		using Shape::display;
+		void display(Canvas& canvas, const View& view)
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			if (!pending_folds())
+				flatten_locked();
+			//A pending translation is drawn by moving the view
+			View shapes_view = folded(view, CIRCLE), lines_view = folded(view, LINE);
+			Canvas::Counters& counters = canvas.counters();
+			const std::vector<Shape*>& components = candidates(shapes_view, canvas.width(), canvas.height());
+			counters.culled += components_.size() - components.size();
+			for (auto component : components)
+			{
+				const View& shape_view = component->type() == LINE ? lines_view : shapes_view;
+				Visible visible = visibility(component, shape_view, canvas.width(), canvas.height());
+				if (visible.visibility == CULLED)
+				{
+					++counters.culled;
+				}
+				else if (visible.visibility == POINT)
+				{
+					++counters.collapsed;
+					canvas.set_color(visible.color);
+					canvas.span(visible.y, visible.x, visible.x + 1);
+				}
+				else
+				{
+					if (component->type() != IMAGE)
+						++counters.drawn;
+					component->display(canvas, shape_view);
+				}
+			}
+			for (std::size_t i = 0; i < packed_.size(); ++i)
+			{
+				const View& shape_view = packed_.slot(i).type == LINE ? lines_view : shapes_view;
+				Visible visible = visibility(packed_.bounding_box(i), packed_.slot(i).type, shape_view, canvas.width(), canvas.height());
+				if (visible.visibility == CULLED)
+				{
+					++counters.culled;
+				}
+				else if (visible.visibility == POINT)
+				{
+					++counters.collapsed;
+					canvas.set_color(packed_.color(i));
+					canvas.span(visible.y, visible.x, visible.x + 1);
+				}
+				else
+				{
+					++counters.drawn;
+					packed_.display(i, canvas, shape_view);
+				}
+			}
+		}
+		/*!
+		Function to display the image. This is called on the Image we actually want to display. It compute a ratio to be able to fit every shapes in the fixed size displayable texture.
+		If the shapes need to be resized, a ratio is passed to the display function.
+		*/
+		void display(Canvas& canvas)
+		{
+			float final_ratio = fit_ratio(canvas.width(), canvas.height());
+			display(canvas, View(final_ratio, Vec2((canvas.width() / 2), (canvas.height() / 2))));
+		}
+		/*!
+		Function to display the image on a framebuffer with several threads, fitting it as display(Canvas&) does.
+		The framebuffer is split in tiles of tile_size pixels, and every shape is binned, in order, into the tiles its bounding box overlaps
+		(the shapes of nested images are binned directly). The threads then draw whole tiles, each through a view clipped to the tile,
+		so no pixel is written by two threads and the shapes are still painted in order within each tile.
+		Shapes are culled and collapsed as display(Canvas&, const View&) does, and counted in the counters of the framebuffer.
+		*/
+		void display_parallel(Framebuffer& framebuffer, std::size_t nb_threads, int tile_size = 64)
+		{
+			float ratio = fit_ratio(framebuffer.width(), framebuffer.height());
+			std::vector<std::unique_lock<std::mutex>> locks;
+			locks.emplace_back(mutex);
+
+			int w = framebuffer.width(), h = framebuffer.height();
+			tile_size = std::max(tile_size, 1);
+			int tiles_x = (w + tile_size - 1) / tile_size;
+			int tiles_y = (h + tile_size - 1) / tile_size;
+			std::vector<std::vector<Visible>> bins(tiles_x * tiles_y);
+			View view(ratio, Vec2((w / 2), (h / 2)));
+			bin(*this, view, w, h, tile_size, tiles_x, bins, locks, framebuffer.counters());
+
+			std::atomic<std::size_t> next(0);
+			auto worker = [&]()
+			{
+				for (std::size_t t = next++; t < bins.size(); t = next++)
+				{
+					if (bins[t].empty())
+						continue;
+					int x0 = (int)(t % tiles_x) * tile_size;
+					int y0 = (int)(t / tiles_x) * tile_size;
+					Framebuffer tile(framebuffer, x0, y0, x0 + tile_size, y0 + tile_size);
+					for (auto& visible : bins[t])
+					{
+						if (visible.visibility == POINT)
+						{
+							tile.set_color(visible.color);
+							tile.span(visible.y, visible.x, visible.x + 1);
+						}
+						else if (visible.shape)
+						{
+							visible.shape->display(tile, visible.view);
+						}
+						else
+						{
+							visible.packed->display(visible.slot, tile, visible.view);
+						}
+					}
+				}
+			};
+			std::vector<std::thread> threads;
+			for (std::size_t i = 1; i < std::min(nb_threads, bins.size()); ++i)
+				threads.emplace_back(worker);
+			worker();
+			for (auto& thread : threads)
+				thread.join();
+		}
+		/*!
+		Function to display the image fitted in the canvas, as display(Canvas&) does, from a rendering kept in memory.
+		The components are drawn again, with every core, only when the image changed (see revision) or the canvas size did :
+		otherwise displaying costs a single blit.
+		*/
+		void display_cached(Canvas& canvas)
+		{
+			uint64_t current = revision();
+			std::lock_guard<std::mutex> guard(cache_mutex_);
+			if (!cache_ || cache_->width() != canvas.width() || cache_->height() != canvas.height())
+			{
+				cache_.reset(new Framebuffer(canvas.width(), canvas.height()));
+				cache_revision_ = 0;
+			}
+			if (cache_revision_ != current)
+			{
+				cache_->clear(Color(255, 255, 255));
+				cache_->counters() = Canvas::Counters();
+				display_parallel(*cache_, std::max(1u, std::thread::hardware_concurrency()));
+				cache_revision_ = current;
+				canvas.counters() += cache_->counters();
+			}
+			canvas.blit(*cache_);
+		}
+		/*!
+		Function to display the image with the SDL library, fitting it in the renderer as above
+		*/
+		void display(SDL_Renderer* renderer)
+		{
+			SDLCanvas canvas(renderer);
+			display(canvas);
+		}
+
+		/*!
+		Getter for the image' annotation
+		*/
+		std::string get_annotation()
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			return annotation;
+		}
+		/*!
+		Setter for the image' annotation
+		*/
+		void annotate(std::string msg)
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			annotate_locked(msg);
+		}
+		/*!
+		Function to serialize the image into string, equivalent to serialize all of its components
+		*/
+		void serialize(std::string& serial)
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			flatten_locked();
+			for (auto component : components_)
+			{
+				component->serialize(serial);
+			}
+			for (std::size_t i = 0; i < packed_.size(); ++i)
+			{
+				packed_.visit(i, [&](Shape& shape) { shape.serialize(serial); });
+			}
+			serial = serial + " annotation " + to_string((int)annotation.size()) + " " + annotation;
+		}
+		/*!
+		Function to serialize the image with the given encoding.
+		The binary payload is the binary_marker, 'I', the varint image version, every component record, then an IMAGE record holding the annotation.
+		*/
+		void serialize(std::string& serial, Encoding encoding)
+		{
+			if (encoding == TEXT)
+			{
+				serialize(serial);
+				return;
+			}
+			std::lock_guard<std::mutex> guard(mutex);
+			flatten_locked();
+			serial.push_back(binary_marker);
+			serial.push_back('I');
+			write_varint(serial, version_);
+			encode_components(serial);
+			write_byte(serial, IMAGE);
+			write_string(serial, annotation);
+		}
+		/*!
+		Function to serialize only what changed since the version the peer acknowledged, in binary.
+		The payload is the binary_marker, 'D', the varint base and new versions, the varint count of removed ids followed by these ids,
+		then the records of every shape added or modified since the base version, and an IMAGE record if the annotation changed.
+		Return false, leaving serial untouched, if the peer acknowledged nothing yet : a full image must be sent instead.
+		*/
+		bool serialize_delta(std::string& serial)
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			flatten_locked();
+			if (acked_version_ == 0)
+				return false;
+			serial.push_back(binary_marker);
+			serial.push_back('D');
+			write_varint(serial, acked_version_);
+			write_varint(serial, version_);
+			write_varint(serial, (uint32_t)removed_.size());
+			for (auto removed : removed_)
+			{
+				write_varint(serial, removed.first);
+			}
+			for (auto component : components_)
+			{
+				if (component->m_version > acked_version_)
+					component->encode(serial);
+			}
+			for (std::size_t i = 0; i < packed_.size(); ++i)
+			{
+				if (packed_.version(i) > acked_version_)
+					packed_.visit(i, [&](Shape& shape) { shape.encode(serial); });
+			}
+			if (annotation_version_ > acked_version_)
+			{
+				write_byte(serial, IMAGE);
+				write_string(serial, annotation);
+			}
+			return true;
+		}
+		/*!
+		Function to encode the image into a binary payload, equivalent to encode all of its components.
+		Nested images are flattened since only the top level image carries an annotation on the wire.
+		*/
+		void encode(std::string& out)
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			flatten_locked();
+			encode_components(out);
+		}
+		/*!
+		Function to deserialize a payload into an image, without copying it when it is binary.
+		/!\ this function erase all existing components /!\
+		*/
+		void deserialize(const char* data, std::size_t size)
+		{
+			if (size && data[0] == binary_marker)
+			{
+				decode(data + 1, size - 1);
+				return;
+			}
+			deserialize(std::string(data, size));
+		}
+		/*!
+		Function to deserialize a string into an image. Both text and binary payloads are accepted.
+		/!\ this function erase all existing components /!\
+		*/
+		void deserialize(std::string s)
+		{
+			if (!s.empty() && s[0] == binary_marker)
+			{
+				decode(s.data() + 1, s.size() - 1);
+				return;
+			}
+			std::lock_guard<std::mutex> guard(mutex);
+			clear_locked();
+			std::istringstream buf(s);
+			for (std::string word; buf >> word;)
+			{
+				switch (Shape::ShapeStringToEnum(word))
+				{
+					case Shape::CIRCLE:
+					{
+						try
+						{
+							buf >> word;
+							float x = std::stof(word);
+							buf >> word;
 							float y = std::stof(word);
 							buf >> word;
 							float rad = std::stof(word);
@@ -1289,7 +2537,7 @@ namespace Patchwork
 							int g = std::stoi(word);
 							buf >> word;
 							int b = std::stoi(word);
-							add_component(new Circle(Vec2(x, y), rad, Color(r, g, b)));
+							add_component_locked(factory_.make<Circle>(Vec2(x, y), rad, Color(r, g, b)));
 						}
 						catch (std::exception& e)
 						{
@@ -1318,7 +2566,7 @@ namespace Patchwork
 							int g = std::stoi(word);
 							buf >> word;
 							int b = std::stoi(word);
-							add_component(new Polygon(points, Color(r, g, b)));
+							add_component_locked(factory_.make<Polygon>(points, Color(r, g, b)));
 						}
 						catch (std::exception& e)
 						{
@@ -1344,7 +2592,7 @@ namespace Patchwork
 							int g = std::stoi(word);
 							buf >> word;
 							int b = std::stoi(word);
-							add_component(new Line(Vec2(x, y), Vec2(dir_x, dir_y), Color(r, g, b)));
+							add_component_locked(factory_.make<Line>(Vec2(x, y), Vec2(dir_x, dir_y), Color(r, g, b)));
 						}
 						catch (std::exception& e)
 						{
@@ -1370,42 +2618,860 @@ namespace Patchwork
 							int g = std::stoi(word);
 							buf >> word;
 							int b = std::stoi(word);
-							add_component(new Ellipse(Vec2(x, y), Vec2(rad_x, rad_y), Color(r, g, b)));
+							add_component_locked(factory_.make<Ellipse>(Vec2(x, y), Vec2(rad_x, rad_y), Color(r, g, b)));
+						}
+						catch (std::exception& e)
+						{
+							std::cout << "Bad format : " << e.what() << std::endl;
+						}
+					}break;
+
+					case Shape::UNKNOWN:
+					{
+						//Assume only annotation cast the unknown shape enum
+						try
+						{
+							buf >> word;
+							int string_size = std::stoi(word);
+							//Skip the separator then read exactly string_size characters, whatever their size
+							buf.get();
+							std::string annotation(string_size, '\0');
+							buf.read(&annotation[0], string_size);
+							annotation.resize((std::size_t)buf.gcount());
+							annotate_locked(annotation);
 						}
 						catch (std::exception& e)
 						{
 							std::cout << "Bad format : " << e.what() << std::endl;
 						}
 					}break;
+				}
+			}
+		}
+		/*!
+		Function to decode a binary payload (without its binary_marker) into the image.
+		A full image erases all existing components, a delta is applied on top of them if its base version is not newer than
+		the last version received, since it then holds every change the image is missing.
+		*/
+		void decode(const char* data, std::size_t size)
+		{
+			BinaryReader reader(data, size);
+			unsigned char kind = reader.read_byte();
+			std::lock_guard<std::mutex> guard(mutex);
+			flatten_locked();
+			//The records replace components by id : a packed image is decoded as pointers then packed again
+			bool repack = packed_storage_;
+			unpack_locked();
+			uint32_t version;
+			if (kind == 'I')
+			{
+				version = reader.read_varint();
+				//The shapes the image made go back to the pools at once
+				components_.clear();
+				nested_.clear();
+				factory_.clear();
+			}
+			else if (kind == 'D')
+			{
+				uint32_t base = reader.read_varint();
+				version = reader.read_varint();
+				if (base > received_version_)
+				{
+					std::cout << "Delta ignored : based on version " << base << " but version " << received_version_ << " was received" << std::endl;
+					if (repack)
+						pack_locked();
+					return;
+				}
+				uint32_t nb_removed = reader.read_varint();
+				if (nb_removed > reader.remaining())
+				{
+					std::cout << "Bad format : corrupted binary image" << std::endl;
+					if (repack)
+						pack_locked();
+					return;
+				}
+				for (uint32_t i = 0; i < nb_removed; i++)
+				{
+					auto it = find_component(reader.read_varint());
+					if (it != components_.end())
+					{
+						forget_nested(*it);
+						release(*it);
+						components_.erase(it);
+					}
+				}
+			}
+			else
+			{
+				std::cout << "Bad format : unknown binary payload" << std::endl;
+				if (repack)
+					pack_locked();
+				return;
+			}
+
+			bool bad_tag = false;
+			while (reader.ok() && reader.remaining() && !bad_tag)
+			{
+				bad_tag = !decode_record(reader, version);
+			}
+			if (!reader.ok() || bad_tag)
+			{
+				std::cout << "Bad format : corrupted binary image" << std::endl;
+			}
+			version_ = version;
+			forget_history(version);
+			index_dirty_ = true;
+			bbox_valid_ = false;
+			if (repack)
+				pack_locked();
+			touch();
+		}
+
+		/*!
+		Getter for the image' components list
+		*/
+		std::vector< Shape* >& components()
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			flatten_locked();
+			return components_;
+		}
+
+	private:
+		/*!
+		Append the binary record of every component, the mutex must already be held
+		*/
+		void encode_components(std::string& out)
+		{
+			for (auto component : components_)
+			{
+				component->encode(out);
+			}
+			for (std::size_t i = 0; i < packed_.size(); ++i)
+			{
+				packed_.visit(i, [&](Shape& shape) { shape.encode(out); });
+			}
+		}
+		/*!
+		Find a component by id, relying on ids increasing in components order. Return components_.end() if not found.
+		*/
+		std::vector< Shape* >::iterator find_component(uint32_t id)
+		{
+			auto it = std::lower_bound(components_.begin(), components_.end(), id,
+				[](const Shape* s, uint32_t id) { return s->m_id < id; });
+			if (it != components_.end() && (*it)->m_id == id)
+				return it;
+			return components_.end();
+		}
+		/*!
+		Decode one binary record and store it, replacing the component with the same id if any.
+		Return false on an unknown tag. The mutex must already be held.
+		*/
+		bool decode_record(BinaryReader& reader, uint32_t version)
+		{
+			unsigned char tag = reader.read_byte();
+			Shape* s = nullptr;
+			switch (tag)
+			{
+				case Shape::CIRCLE:
+				{
+					uint32_t id = reader.read_varint();
+					float x = reader.read_float();
+					float y = reader.read_float();
+					float rad = reader.read_float();
+					Color c = reader.read_color();
+					if (reader.ok())
+					{
+						s = factory_.make<Circle>(Vec2(x, y), rad, c);
+						s->m_id = id;
+					}
+				}break;
 
-					case Shape::UNKNOWN:
+				case Shape::POLYGON:
+				{
+					uint32_t id = reader.read_varint();
+					uint32_t nb_pts = reader.read_varint();
+					//Each vertex takes 8 bytes, don't trust a count the payload can't hold
+					if (nb_pts > reader.remaining() / 8)
+						return false;
+					std::vector<Vec2> points;
+					points.reserve(nb_pts);
+					for (uint32_t i = 0; i < nb_pts; i++)
 					{
-						//Assume only annotation cast the unknown shape enum
-						buf >> word;
-						int string_size = std::stoi(word);
-						char buffer[1024];
-						buf.getline(buffer, string_size + 2);
-						std::string annotation = std::string(buffer);
-						annotate(annotation);
-					}break;
+						float x = reader.read_float();
+						float y = reader.read_float();
+						points.push_back(Vec2(x, y));
+					}
+					Color c = reader.read_color();
+					if (reader.ok())
+					{
+						s = factory_.make<Polygon>(points, c);
+						s->m_id = id;
+					}
+				}break;
+
+				case Shape::LINE:
+				{
+					uint32_t id = reader.read_varint();
+					float x = reader.read_float();
+					float y = reader.read_float();
+					float dir_x = reader.read_float();
+					float dir_y = reader.read_float();
+					Color c = reader.read_color();
+					if (reader.ok())
+					{
+						s = factory_.make<Line>(Vec2(x, y), Vec2(dir_x, dir_y), c);
+						s->m_id = id;
+					}
+				}break;
+
+				case Shape::ELLIPSE:
+				{
+					uint32_t id = reader.read_varint();
+					float x = reader.read_float();
+					float y = reader.read_float();
+					float rad_x = reader.read_float();
+					float rad_y = reader.read_float();
+					Color c = reader.read_color();
+					if (reader.ok())
+					{
+						s = factory_.make<Ellipse>(Vec2(x, y), Vec2(rad_x, rad_y), c);
+						s->m_id = id;
+					}
+				}break;
+
+				case Shape::IMAGE:
+				{
+					std::string msg = reader.read_string();
+					if (reader.ok())
+					{
+						annotation = msg;
+						annotation_version_ = version;
+					}
+				}break;
+
+				default:
+				{
+					return false;
+				}
+			}
+			if (s)
+			{
+				s->translate(origin_);
+				s->m_version = version;
+				auto it = std::lower_bound(components_.begin(), components_.end(), s->m_id,
+					[](const Shape* c, uint32_t id) { return c->m_id < id; });
+				if (it != components_.end() && (*it)->m_id == s->m_id)
+				{
+					forget_nested(*it);
+					release(*it);
+					*it = s;
 				}
+				else
+					components_.insert(it, s);
+				if (s->m_id >= next_id_)
+					next_id_ = s->m_id + 1;
 			}
+			return true;
 		}
+		/*!
+		Compute the ratio to apply to the components so the whole image fits in a w x h target (1 if it already fits).
+		*/
+		float fit_ratio(int w, int h)
+		{
+			BoundingBox bb = bounding_box();
+			if (bb.empty())
+				return 1.f;
+			Vec2 center((w / 2), (h / 2));
+			bb.x_max = bb.x_max + center.x;
+			bb.x_min = bb.x_min + center.x;
+			bb.y_max = bb.y_max + center.y;
+			bb.y_min = bb.y_min + center.y;
+			Vec2 v1 = (center - Vec2( bb.x_max, bb.y_max ));
+			Vec2 v2 = (center - Vec2(bb.x_min, bb.y_min));
+			int im_w, im_h;
+			float n1 = norm(v1);
+			float n2 = norm(v2);
+			if (norm(v1) > norm(v2))
+			{
+				im_w = n1 * 2;
+				im_h = im_w;
+			}
+			else
+			{
+				im_w = n2 * 2;
+				im_h = im_w;
+			}
+
+			float w_ratio = (float) w / im_w;
+			float h_ratio = (float) h / im_h;
+			float final_ratio = 1.f;
 
+			if (w_ratio < 1.f || h_ratio < 1.f)
+			{
+				if (w_ratio <= h_ratio)
+				{
+					final_ratio = w_ratio;
+				}
+				else
+				{
+					final_ratio = h_ratio;
+				}
+			}
+			return final_ratio;
+		}
 		/*!
-		Getter for the image' components list
+		What becomes of a shape seen through a view on a w x h target
 		*/
-		std::vector< Shape* >& components()
+		enum Visibility { CULLED = 0, POINT, FULL };
+		/*!
+		A shape with its visibility, and its pixel and color when collapsed to a POINT
+		*/
+		struct Visible
+		{
+			Shape* shape; /*!< The shape, null for a packed one */
+			const Packed* packed; /*!< Storage of a packed shape */
+			std::size_t slot; /*!< Position of a packed shape in its storage */
+			Visibility visibility;
+			int x, y;
+			Color color;
+			View view; /*!< View the shape is drawn through, moved by the pending translation of its image */
+		};
+		/*!
+		Compute the visibility of a shape (or a nested image, which must not be locked) seen through the view on a w x h target :
+		CULLED if its bounding box is outside of the target (or empty), POINT if it is smaller than a pixel, else FULL.
+		*/
+		static Visible visibility(Shape* shape, const View& view, int w, int h)
+		{
+			Visible visible = visibility(shape->bounding_box(), shape->type(), view, w, h);
+			visible.shape = shape;
+			if (visible.visibility != POINT)
+				return visible;
+			if (shape->type() == IMAGE)
+			{
+				if (!static_cast<Image*>(shape)->top_color(visible.color))
+					visible.visibility = CULLED;
+			}
+			else
+			{
+				visible.color = shape->color();
+			}
+			return visible;
+		}
+		/*!
+		Compute the visibility of a shape of the given type and bounding box, without its color
+		*/
+		static Visible visibility(const BoundingBox& bb, Derivedtype type, const View& view, int w, int h)
+		{
+			Visible visible = { nullptr, nullptr, 0, CULLED, 0, 0, Color(), view };
+			if (bb.empty())
+				return visible;
+			//The rasterizers spill one pixel around the boxes, and round their corners, hence the margin.
+			//A line is drawn unscaled
+			const float margin = 2.f;
+			float scale = type == LINE ? 1.f : view.scale;
+			float x_min = bb.x_min * scale + view.offset.x;
+			float x_max = bb.x_max * scale + view.offset.x;
+			float y_min = bb.y_min * scale + view.offset.y;
+			float y_max = bb.y_max * scale + view.offset.y;
+			if (x_max + margin < 0.f || y_max + margin < 0.f || x_min - margin >= (float)w || y_min - margin >= (float)h)
+				return visible;
+			if (x_max - x_min >= 1.f || y_max - y_min >= 1.f)
+			{
+				visible.visibility = FULL;
+				return visible;
+			}
+			visible.x = (int)std::floor((x_min + x_max) / 2.f);
+			visible.y = (int)std::floor((y_min + y_max) / 2.f);
+			if (visible.x < 0 || visible.y < 0 || visible.x >= w || visible.y >= h)
+				return visible;
+			visible.visibility = POINT;
+			return visible;
+		}
+		/*!
+		Get the color of the component painted last, looking into nested images. Return false if there is none.
+		*/
+		bool top_color(Color& color)
 		{
 			std::lock_guard<std::mutex> guard(mutex);
-			return components_;
+			if (packed_.size())
+			{
+				color = packed_.color(packed_.size() - 1);
+				return true;
+			}
+			for (auto it = components_.rbegin(); it != components_.rend(); ++it)
+			{
+				if ((*it)->type() != IMAGE)
+				{
+					color = (*it)->color();
+					return true;
+				}
+				if (static_cast<Image*>(*it)->top_color(color))
+					return true;
+			}
+			return false;
+		}
+		/*!
+		Append every visible shape of the image, in order, to the bins as below, its pending translation moving the view.
+		The mutex of the image must already be held.
+		*/
+		static void bin(Image& image, const View& view, int w, int h, int tile_size, int tiles_x,
+			std::vector<std::vector<Visible>>& bins, std::vector<std::unique_lock<std::mutex>>& locks, Canvas::Counters& counters)
+		{
+			if (!image.pending_folds())
+				image.flatten_locked();
+			View shapes_view = image.folded(view, CIRCLE), lines_view = image.folded(view, LINE);
+			const std::vector<Shape*>& components = image.candidates(shapes_view, w, h);
+			counters.culled += image.components_.size() - components.size();
+			bin(components, shapes_view, lines_view, w, h, tile_size, tiles_x, bins, locks, counters);
+			bin(image.packed_, shapes_view, lines_view, w, h, tile_size, tiles_x, bins, counters);
+		}
+		/*!
+		Append every visible shape of components, in order, to the bins of the tiles its bounding box (or its pixel when collapsed) overlaps
+		once seen through the view (lines_view for the lines), counting them in counters.
+		Nested images are walked into, holding their mutex in locks until the drawing is done.
+		*/
+		static void bin(const std::vector<Shape*>& components, const View& view, const View& lines_view, int w, int h, int tile_size, int tiles_x,
+			std::vector<std::vector<Visible>>& bins, std::vector<std::unique_lock<std::mutex>>& locks, Canvas::Counters& counters)
+		{
+			for (auto component : components)
+			{
+				const View& shape_view = component->type() == LINE ? lines_view : view;
+				Visible visible = visibility(component, shape_view, w, h);
+				if (visible.visibility == CULLED)
+				{
+					++counters.culled;
+					continue;
+				}
+				if (visible.visibility == POINT)
+				{
+					++counters.collapsed;
+					bins[(visible.y / tile_size) * tiles_x + visible.x / tile_size].push_back(visible);
+					continue;
+				}
+				if (component->type() == IMAGE)
+				{
+					Image* image = static_cast<Image*>(component);
+					locks.emplace_back(image->mutex);
+					bin(*image, view, w, h, tile_size, tiles_x, bins, locks, counters);
+					continue;
+				}
+				++counters.drawn;
+				place(visible, component->bounding_box(), component->type(), shape_view, tile_size, tiles_x, bins);
+			}
+		}
+		/*!
+		Append every visible packed shape, in order, to the bins as above
+		*/
+		static void bin(const Packed& packed, const View& view, const View& lines_view, int w, int h, int tile_size, int tiles_x,
+			std::vector<std::vector<Visible>>& bins, Canvas::Counters& counters)
+		{
+			for (std::size_t i = 0; i < packed.size(); ++i)
+			{
+				BoundingBox bb = packed.bounding_box(i);
+				const View& shape_view = packed.slot(i).type == LINE ? lines_view : view;
+				Visible visible = visibility(bb, packed.slot(i).type, shape_view, w, h);
+				visible.packed = &packed;
+				visible.slot = i;
+				if (visible.visibility == CULLED)
+				{
+					++counters.culled;
+					continue;
+				}
+				if (visible.visibility == POINT)
+				{
+					++counters.collapsed;
+					visible.color = packed.color(i);
+					bins[(visible.y / tile_size) * tiles_x + visible.x / tile_size].push_back(visible);
+					continue;
+				}
+				++counters.drawn;
+				place(visible, bb, packed.slot(i).type, shape_view, tile_size, tiles_x, bins);
+			}
+		}
+		/*!
+		Append a shape drawn in full to the bins of the tiles its bounding box overlaps once seen through the view
+		*/
+		static void place(const Visible& visible, const BoundingBox& bb, Derivedtype type, const View& view, int tile_size, int tiles_x,
+			std::vector<std::vector<Visible>>& bins)
+		{
+			const float margin = 2.f;
+			float scale = type == LINE ? 1.f : view.scale;
+			float x_min = std::floor(bb.x_min * scale + view.offset.x - margin);
+			float x_max = std::floor(bb.x_max * scale + view.offset.x + margin);
+			float y_min = std::floor(bb.y_min * scale + view.offset.y - margin);
+			float y_max = std::floor(bb.y_max * scale + view.offset.y + margin);
+			int tiles_y = (int)bins.size() / tiles_x;
+			int tx0 = (int)std::max(x_min, 0.f) / tile_size, tx1 = std::min(tiles_x - 1, (int)std::min(x_max, (float)tiles_x * tile_size) / tile_size);
+			int ty0 = (int)std::max(y_min, 0.f) / tile_size, ty1 = std::min(tiles_y - 1, (int)std::min(y_max, (float)tiles_y * tile_size) / tile_size);
+			for (int ty = ty0; ty <= ty1; ++ty)
+				for (int tx = tx0; tx <= tx1; ++tx)
+					bins[ty * tiles_x + tx].push_back(visible);
+		}
+		/*!
+		Add a component to the index, if enabled and not waiting for a rebuild. The mutex must already be held.
+		*/
+		void index_insert(Shape* s)
+		{
+			if (!index_ || index_dirty_)
+				return;
+			if (s->type() == LINE || s->type() == IMAGE)
+			{
+				unindexed_.push_back(s);
+				return;
+			}
+			BoundingBox bb = s->bounding_box();
+			if (bb.empty())
+				return;
+			index_->insert(s, bb.x_min - index_shift_.x, bb.y_min - index_shift_.y, bb.x_max - index_shift_.x, bb.y_max - index_shift_.y);
+		}
+		/*!
+		Remove a component from the index, if enabled. The mutex must already be held.
+		*/
+		void index_remove(Shape* s)
+		{
+			if (!index_ || index_dirty_)
+				return;
+			auto it = std::find(unindexed_.begin(), unindexed_.end(), s);
+			if (it != unindexed_.end())
+				unindexed_.erase(it);
+			else
+				index_->remove(s);
+		}
+		/*!
+		Put every component in the index again when it waits for a rebuild. The mutex must already be held.
+		*/
+		void index_update()
+		{
+			if (!index_dirty_)
+				return;
+			index_->clear();
+			unindexed_.clear();
+			index_shift_ = Vec2();
+			index_dirty_ = false;
+			for (auto component : components_)
+				index_insert(component);
+		}
+		/*!
+		Replace out with the components which may overlap the region (every component without an index), in painting order.
+		The mutex must already be held.
+		*/
+		void gather(float x_min, float y_min, float x_max, float y_max, std::vector<Shape*>& out)
+		{
+			out.clear();
+			if (!index_)
+			{
+				out = components_;
+				return;
+			}
+			index_update();
+			index_->query(x_min - index_shift_.x, y_min - index_shift_.y, x_max - index_shift_.x, y_max - index_shift_.y, out);
+			out.insert(out.end(), unindexed_.begin(), unindexed_.end());
+			//Ids increase in components order
+			std::sort(out.begin(), out.end(), [](const Shape* a, const Shape* b) { return a->m_id < b->m_id; });
+		}
+		/*!
+		Get the components which may be seen through the view on a w x h target, in painting order : the components in the region
+		of the target when indexed, else all of them. The result is only valid until the next call. The mutex must already be held.
+		*/
+		const std::vector<Shape*>& candidates(const View& view, int w, int h)
+		{
+			if (!index_ || view.scale <= 0.f)
+				return components_;
+			//Same margin as visibility
+			const float margin = 2.f;
+			gather((-margin - view.offset.x) / view.scale, (-margin - view.offset.y) / view.scale,
+				((float)w + margin - view.offset.x) / view.scale, ((float)h + margin - view.offset.y) / view.scale, candidates_);
+			return candidates_;
+		}
+		/*!
+		Compose a transform of the components into the pending transform, see flatten : shapes for the circles, polygons, lines and nested images,
+		ellipses for the ellipses, whose own functions skip the rotations. The mutex must already be held.
+		*/
+		void compose_locked(const Affine& shapes, const Affine& ellipses)
+		{
+			++version_;
+			touch();
+			pending_ = shapes * pending_;
+			pending_ellipses_ = ellipses * pending_ellipses_;
+			pending_version_ = version_;
+			pending_active_ = !(pending_.is_identity() && pending_ellipses_.is_identity());
+		}
+		/*!
+		Compose a transform into the pending transform of a nested image, for its parent's flatten
+		*/
+		void compose(const Affine& shapes, const Affine& ellipses)
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			compose_locked(shapes, ellipses);
+		}
+		/*!
+		Apply the pending transform to the components, see flatten. The mutex must already be held.
+		*/
+		void flatten_locked()
+		{
+			if (!pending_active_)
+				return;
+			Affine shapes = pending_, ellipses = pending_ellipses_;
+			Vec2 shift;
+			bool translation = pending_shift(shift);
+			reset_pending();
+			//Every box moves alike under a translation : move the index and the bounding box with them instead of rebuilding them
+			bool bbox_up_to_date = translation && bbox_valid_ && nested_revision() == bbox_nested_revision_;
+			if (translation)
+				index_shift_ = index_shift_ + shift;
+			else
+				index_dirty_ = true;
+			packed_.transform(shapes, ellipses);
+			packed_.stamp(pending_version_);
+			for (auto component : components_)
+			{
+				switch (component->type())
+				{
+					case ELLIPSE: component->transform(ellipses); break;
+					case IMAGE: static_cast<Image*>(component)->compose(shapes, ellipses); break;
+					default: component->transform(shapes); break;
+				}
+				component->m_version = pending_version_;
+			}
+			bbox_valid_ = bbox_up_to_date;
+			if (bbox_valid_)
+			{
+				bbox_.x_min += shift.x;
+				bbox_.x_max += shift.x;
+				bbox_.y_min += shift.y;
+				bbox_.y_max += shift.y;
+				bbox_nested_revision_ = nested_revision();
+			}
+		}
+		/*!
+		Add a component to the image, see add_component. The mutex must already be held.
+		*/
+		uint32_t add_component_locked(Shape* s)
+		{
+			flatten_locked();
+			s->translate(origin_);
+			uint32_t id = next_id_++;
+			s->m_id = id;
+			s->m_version = ++version_;
+			touch();
+			if (s->type() == IMAGE)
+				unpack_locked();
+			if (packed_storage_)
+			{
+				packed_.add(s);
+				release(s);
+				if (bbox_valid_)
+					bbox_.merge(packed_.bounding_box(packed_.size() - 1));
+				return id;
+			}
+			components_.push_back(s); 
+			index_insert(s);
+			if (s->type() == IMAGE)
+				nested_.push_back(static_cast<Image*>(s));
+			if (bbox_valid_)
+				bbox_.merge(s->bounding_box());
+			return id;
+		}
+		/*!
+		Set the annotation, see annotate. The mutex must already be held.
+		*/
+		void annotate_locked(const std::string& msg)
+		{
+			annotation = msg;
+			annotation_version_ = ++version_;
+		}
+		/*!
+		Erase every component, the pending transform and the history, before a text payload is parsed. The mutex must already be held.
+		*/
+		void clear_locked()
+		{
+			components_.clear();
+			nested_.clear();
+			packed_.clear();
+			factory_.clear();
+			reset_pending();
+			index_dirty_ = true;
+			bbox_valid_ = false;
+			forget_history(0);
+			touch();
+		}
+		/*!
+		Forget the pending transform without applying it
+		*/
+		void reset_pending()
+		{
+			pending_ = pending_ellipses_ = Affine();
+			pending_active_ = false;
+		}
+		/*!
+		Whether the pending transform translates every component alike, by shift (nothing pending is a null translation)
+		*/
+		bool pending_shift(Vec2& shift) const
+		{
+			if (!pending_.is_translation() || !pending_ellipses_.is_translation() || pending_ellipses_.tx != pending_.tx || pending_ellipses_.ty != pending_.ty)
+				return false;
+			shift = Vec2(pending_.tx, pending_.ty);
+			return true;
+		}
+		/*!
+		Whether the display functions can draw the pending transform by moving the view : nothing is pending,
+		or a translation without nested images, which don't take a view per type of shape
+		*/
+		bool pending_folds() const
+		{
+			Vec2 shift;
+			return !pending_active_ || (nested_.empty() && pending_shift(shift));
+		}
+		/*!
+		View drawing the shapes of the given type moved by the pending translation, see pending_folds
+		*/
+		View folded(const View& view, Derivedtype type) const
+		{
+			if (!pending_active_)
+				return view;
+			//Lines are drawn unscaled, their translation too
+			float scale = type == LINE ? 1.f : view.scale;
+			return View(view.scale, view.offset + scale * Vec2(pending_.tx, pending_.ty));
+		}
+		/*!
+		Whether a component's box reaches an edge of the bounding box in cache, so removing it may shrink the bounding box
+		*/
+		bool touches_edge(const BoundingBox& bb) const
+		{
+			return !bb.empty() && (bb.x_min <= bbox_.x_min || bb.x_max >= bbox_.x_max || bb.y_min <= bbox_.y_min || bb.y_max >= bbox_.y_max);
+		}
+		/*!
+		Move the components into packed storage, see pack. The mutex must already be held.
+		*/
+		bool pack_locked()
+		{
+			if (packed_storage_)
+				return true;
+			for (auto component : components_)
+			{
+				if (component->type() == IMAGE)
+					return false;
+			}
+			for (auto component : components_)
+			{
+				packed_.add(component);
+				release(component);
+			}
+			components_.clear();
+			packed_storage_ = true;
+			index_dirty_ = true;
+			return true;
+		}
+		/*!
+		Move the components back out of packed storage, see unpack. The mutex must already be held.
+		*/
+		void unpack_locked()
+		{
+			if (!packed_storage_)
+				return;
+			components_.reserve(components_.size() + packed_.size());
+			for (std::size_t i = 0; i < packed_.size(); ++i)
+				components_.push_back(packed_.make(i, factory_));
+			packed_.clear();
+			packed_storage_ = false;
+			index_dirty_ = true;
+		}
+		/*!
+		Release a shape the image is done with, through its own type, Shape having no virtual destructor : given back to the pools if the image made it,
+		else left to its owner (nested images included). The mutex must already be held.
+		*/
+		void release(Shape* s)
+		{
+			switch (s->type())
+			{
+				case CIRCLE: release(static_cast<Circle*>(s)); break;
+				case POLYGON: release(static_cast<Polygon*>(s)); break;
+				case LINE: release(static_cast<Line*>(s)); break;
+				case ELLIPSE: release(static_cast<Ellipse*>(s)); break;
+				default: break;
+			}
+		}
+		template <typename T>
+		void release(T* s)
+		{
+			if (factory_.owns(s))
+				factory_.release(s);
+		}
+		/*!
+		Latest revision of the nested images, 0 if none. The mutex must already be held.
+		*/
+		uint64_t nested_revision()
+		{
+			uint64_t revision = 0;
+			for (auto image : nested_)
+				revision = std::max(revision, image->revision());
+			return revision;
+		}
+		/*!
+		Stop following a component leaving the image if it is a nested image. The mutex must already be held.
+		*/
+		void forget_nested(Shape* s)
+		{
+			if (s->type() == IMAGE)
+				nested_.erase(std::remove(nested_.begin(), nested_.end(), static_cast<Image*>(s)), nested_.end());
+		}
+		/*!
+		Next value of the revision counter shared by every image
+		*/
+		static uint64_t next_revision()
+		{
+			static std::atomic<uint64_t> counter(0);
+			return ++counter;
+		}
+		/*!
+		Give the image a new revision after an edit that changes what it looks like, invalidating the rendering in cache
+		*/
+		void touch()
+		{
+			revision_ = next_revision();
+		}
+		/*!
+		Reset the synchronization state after the content was replaced by the peer's version (0 for a text payload).
+		The mutex must already be held.
+		*/
+		void forget_history(uint32_t version)
+		{
+			received_version_ = version;
+			acked_version_ = 0;
+			removed_.clear();
 		}
 
-	private:
 		std::vector< Shape* > components_; /*!< List of componentns */
 		std::string annotation; /*!< annotation */
 		std::mutex mutex; /*!< mutex to achieve thread safety */
 		Vec2 origin_; /*!< ellipse center */
+		uint32_t version_; /*!< Version of the image, incremented on every edit */
+		uint32_t received_version_; /*!< Version of the peer's image last received in binary, 0 if none */
+		uint32_t acked_version_; /*!< Version the peer acknowledged holding, base of the next delta, 0 if none */
+		uint32_t annotation_version_; /*!< Version at which the annotation last changed */
+		uint32_t next_id_; /*!< Id given to the next added component */
+		std::vector< std::pair<uint32_t, uint32_t> > removed_; /*!< Ids of the removed components with the version of their removal, until acknowledged */
+		uint64_t revision_; /*!< Revision of the image itself, see revision() */
+		std::mutex cache_mutex_; /*!< mutex protecting the rendering in cache */
+		std::unique_ptr<Framebuffer> cache_; /*!< Rendering of the image in cache, white background, created on the first display_cached */
+		uint64_t cache_revision_; /*!< Revision the rendering in cache was drawn at, 0 if none */
+		std::unique_ptr<Grid<Shape>> index_; /*!< Index of the components by bounding box, null when disabled */
+		bool index_dirty_; /*!< The index must be rebuilt before its next use */
+		Vec2 index_shift_; /*!< Translation of the image since the index was rebuilt */
+		std::vector<Shape*> unindexed_; /*!< Indexed components kept out of the grid : lines and nested images */
+		std::vector<Shape*> candidates_; /*!< Components kept by the last call to candidates, reused from frame to frame */
+		std::vector<Image*> nested_; /*!< Components which are images, followed for revision and bounding_box */
+		BoundingBox bbox_; /*!< Bounding box in cache, see bounding_box */
+		bool bbox_valid_; /*!< Whether bbox_ holds every component */
+		uint64_t bbox_nested_revision_; /*!< Latest revision of the nested images when bbox_ was computed */
+		Packed packed_; /*!< Components in packed storage, empty unless packed_storage_ */
+		bool packed_storage_; /*!< Whether the components are packed, see pack */
+		ShapeFactory factory_; /*!< Pools of the shapes made by the image, see make */
+		Affine pending_; /*!< Pending transform of the circles, polygons, lines and nested images, see flatten */
+		Affine pending_ellipses_; /*!< Pending transform of the ellipses, without the rotations */
+		bool pending_active_; /*!< Whether a transform is pending */
+		uint32_t pending_version_; /*!< Version of the last transform composed into the pending one */
 	};
 
 
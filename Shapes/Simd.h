@@ -0,0 +1,273 @@
+#pragma once
+#include <cstddef>
+#include "Maths.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PATCHWORK_SIMD_X86 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define PATCHWORK_TARGET_AVX2
+#else
+#define PATCHWORK_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#else
+#define PATCHWORK_SIMD_X86 0
+#endif
+
+/*! \file Simd.h
+\brief Header files containing the coverage predicates of the rasterizer and their vectorized kernels.
+
+The kernels compute the edge crossings of the polygon scanlines and apply affine transforms to arrays of points,
+on 4 (SSE2) or 8 (AVX2) lanes per instruction.
+The instruction set is chosen at runtime, and the scalar fallback evaluates the very same floating point operations in the same order,
+so every level gives bit-identical results.
+*/
+
+static_assert(sizeof(Vec2) == 2 * sizeof(float), "The point kernels read Vec2 arrays as interleaved coordinates");
+
+namespace Patchwork
+{
+	namespace Raster
+	{
+		/*!
+		The predicate of the per pixel circle test, for the pixel (i, j) relative to the center
+		*/
+		inline bool in_circle(int i, int j, float radius)
+		{
+			return i*i + j*j <= radius*radius;
+		}
+		/*!
+		The predicate of the per pixel ellipse test, for the pixel (i, j) relative to the center
+		*/
+		inline bool in_ellipse(int i, int j, const Vec2& radius)
+		{
+			return j*j*radius.x*radius.x + i*i*radius.y*radius.y <= radius.x*radius.x*radius.y*radius.y;
+		}
+		/*!
+		Abscissa at which the row y crosses the edge (a, b), as computed by the polygon crossing test, a being the current vertex
+		*/
+		inline float crossing(float ax, float ay, float bx, float by, float y)
+		{
+			return (bx - ax) * (y - ay) / (by - ay) + ax;
+		}
+	}
+
+	namespace Simd
+	{
+		enum Level { SCALAR = 0, SSE2, AVX2 }; /*!< Instruction sets the kernels can use */
+
+		namespace Scalar
+		{
+			inline void crossings(const float* ax, const float* ay, const float* bx, const float* by, std::size_t n, float y, float* out)
+			{
+				for (std::size_t k = 0; k < n; ++k)
+					out[k] = Raster::crossing(ax[k], ay[k], bx[k], by[k], y);
+			}
+			inline void transform(const Affine& m, float* x, float* y, std::size_t n)
+			{
+				for (std::size_t k = 0; k < n; ++k)
+				{
+					float px = x[k], py = y[k];
+					x[k] = (m.a * px + m.b * py) + m.tx;
+					y[k] = (m.c * px + m.d * py) + m.ty;
+				}
+			}
+			inline void transform(const Affine& m, Vec2* points, std::size_t n)
+			{
+				for (std::size_t k = 0; k < n; ++k)
+					points[k] = m.apply(points[k]);
+			}
+		}
+
+#if PATCHWORK_SIMD_X86
+		namespace Sse2
+		{
+			inline void crossings(const float* ax, const float* ay, const float* bx, const float* by, std::size_t n, float y, float* out)
+			{
+				std::size_t k = 0;
+				__m128 vy = _mm_set1_ps(y);
+				for (; k + 4 <= n; k += 4)
+				{
+					__m128 vax = _mm_loadu_ps(ax + k), vay = _mm_loadu_ps(ay + k);
+					__m128 num = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(bx + k), vax), _mm_sub_ps(vy, vay));
+					_mm_storeu_ps(out + k, _mm_add_ps(_mm_div_ps(num, _mm_sub_ps(_mm_loadu_ps(by + k), vay)), vax));
+				}
+				Scalar::crossings(ax + k, ay + k, bx + k, by + k, n - k, y, out + k);
+			}
+			inline void transform(const Affine& m, float* x, float* y, std::size_t n)
+			{
+				std::size_t k = 0;
+				__m128 a = _mm_set1_ps(m.a), b = _mm_set1_ps(m.b), c = _mm_set1_ps(m.c), d = _mm_set1_ps(m.d);
+				__m128 tx = _mm_set1_ps(m.tx), ty = _mm_set1_ps(m.ty);
+				for (; k + 4 <= n; k += 4)
+				{
+					__m128 px = _mm_loadu_ps(x + k), py = _mm_loadu_ps(y + k);
+					_mm_storeu_ps(x + k, _mm_add_ps(_mm_add_ps(_mm_mul_ps(a, px), _mm_mul_ps(b, py)), tx));
+					_mm_storeu_ps(y + k, _mm_add_ps(_mm_add_ps(_mm_mul_ps(c, px), _mm_mul_ps(d, py)), ty));
+				}
+				Scalar::transform(m, x + k, y + k, n - k);
+			}
+			inline void transform(const Affine& m, Vec2* points, std::size_t n)
+			{
+				//Two interleaved points (x0 y0 x1 y1) per register, and their swapped coordinates (y0 x0 y1 x1)
+				std::size_t k = 0;
+				float* f = reinterpret_cast<float*>(points);
+				__m128 same = _mm_setr_ps(m.a, m.d, m.a, m.d);
+				__m128 swapped = _mm_setr_ps(m.b, m.c, m.b, m.c);
+				__m128 t = _mm_setr_ps(m.tx, m.ty, m.tx, m.ty);
+				for (; k + 2 <= n; k += 2)
+				{
+					__m128 v = _mm_loadu_ps(f + 2 * k);
+					__m128 w = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+					_mm_storeu_ps(f + 2 * k, _mm_add_ps(_mm_add_ps(_mm_mul_ps(same, v), _mm_mul_ps(swapped, w)), t));
+				}
+				Scalar::transform(m, points + k, n - k);
+			}
+		}
+
+		namespace Avx2
+		{
+			PATCHWORK_TARGET_AVX2 inline void crossings(const float* ax, const float* ay, const float* bx, const float* by, std::size_t n, float y, float* out)
+			{
+				std::size_t k = 0;
+				__m256 vy = _mm256_set1_ps(y);
+				for (; k + 8 <= n; k += 8)
+				{
+					__m256 vax = _mm256_loadu_ps(ax + k), vay = _mm256_loadu_ps(ay + k);
+					__m256 num = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(bx + k), vax), _mm256_sub_ps(vy, vay));
+					_mm256_storeu_ps(out + k, _mm256_add_ps(_mm256_div_ps(num, _mm256_sub_ps(_mm256_loadu_ps(by + k), vay)), vax));
+				}
+				Scalar::crossings(ax + k, ay + k, bx + k, by + k, n - k, y, out + k);
+			}
+			PATCHWORK_TARGET_AVX2 inline void transform(const Affine& m, float* x, float* y, std::size_t n)
+			{
+				std::size_t k = 0;
+				__m256 a = _mm256_set1_ps(m.a), b = _mm256_set1_ps(m.b), c = _mm256_set1_ps(m.c), d = _mm256_set1_ps(m.d);
+				__m256 tx = _mm256_set1_ps(m.tx), ty = _mm256_set1_ps(m.ty);
+				for (; k + 8 <= n; k += 8)
+				{
+					__m256 px = _mm256_loadu_ps(x + k), py = _mm256_loadu_ps(y + k);
+					_mm256_storeu_ps(x + k, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a, px), _mm256_mul_ps(b, py)), tx));
+					_mm256_storeu_ps(y + k, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c, px), _mm256_mul_ps(d, py)), ty));
+				}
+				Scalar::transform(m, x + k, y + k, n - k);
+			}
+			PATCHWORK_TARGET_AVX2 inline void transform(const Affine& m, Vec2* points, std::size_t n)
+			{
+				std::size_t k = 0;
+				float* f = reinterpret_cast<float*>(points);
+				__m256 same = _mm256_setr_ps(m.a, m.d, m.a, m.d, m.a, m.d, m.a, m.d);
+				__m256 swapped = _mm256_setr_ps(m.b, m.c, m.b, m.c, m.b, m.c, m.b, m.c);
+				__m256 t = _mm256_setr_ps(m.tx, m.ty, m.tx, m.ty, m.tx, m.ty, m.tx, m.ty);
+				for (; k + 4 <= n; k += 4)
+				{
+					__m256 v = _mm256_loadu_ps(f + 2 * k);
+					__m256 w = _mm256_permute_ps(v, _MM_SHUFFLE(2, 3, 0, 1));
+					_mm256_storeu_ps(f + 2 * k, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(same, v), _mm256_mul_ps(swapped, w)), t));
+				}
+				Scalar::transform(m, points + k, n - k);
+			}
+		}
+#endif
+
+		/*!
+		Best instruction set supported by the processor running the program
+		*/
+		inline Level detect()
+		{
+#if PATCHWORK_SIMD_X86
+#if defined(_MSC_VER)
+			int info[4];
+			__cpuid(info, 0);
+			if (info[0] >= 7)
+			{
+				__cpuidex(info, 7, 0);
+				bool avx2 = (info[1] & (1 << 5)) != 0;
+				__cpuid(info, 1);
+				//AVX2 also needs the OS to save the ymm registers (OSXSAVE and XCR0)
+				bool os_ymm = (info[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6;
+				if (avx2 && os_ymm)
+					return AVX2;
+			}
+			return SSE2;
+#else
+			__builtin_cpu_init();
+			if (__builtin_cpu_supports("avx2"))
+				return AVX2;
+			return __builtin_cpu_supports("sse2") ? SSE2 : SCALAR;
+#endif
+#else
+			return SCALAR;
+#endif
+		}
+		/*!
+		The instruction set in use, detected on first use
+		*/
+		inline Level& current_level()
+		{
+			static Level level = detect();
+			return level;
+		}
+		/*!
+		Getter of the instruction set in use
+		*/
+		inline Level level()
+		{
+			return current_level();
+		}
+		/*!
+		Use at most the given instruction set (to compare them or to rule one out), return the one actually in use
+		*/
+		inline Level set_level(Level wanted)
+		{
+			Level best = detect();
+			current_level() = wanted < best ? wanted : best;
+			return current_level();
+		}
+
+		/*!
+		Crossing abscissas of the row y with n edges given as arrays of coordinates, see Raster::crossing
+		*/
+		inline void crossings(const float* ax, const float* ay, const float* bx, const float* by, std::size_t n, float y, float* out)
+		{
+			switch (level())
+			{
+#if PATCHWORK_SIMD_X86
+			case AVX2: Avx2::crossings(ax, ay, bx, by, n, y, out); break;
+			case SSE2: Sse2::crossings(ax, ay, bx, by, n, y, out); break;
+#endif
+			default: Scalar::crossings(ax, ay, bx, by, n, y, out);
+			}
+		}
+		/*!
+		Apply the affine transform m to n points given as arrays of coordinates
+		*/
+		inline void transform(const Affine& m, float* x, float* y, std::size_t n)
+		{
+			switch (level())
+			{
+#if PATCHWORK_SIMD_X86
+			case AVX2: Avx2::transform(m, x, y, n); break;
+			case SSE2: Sse2::transform(m, x, y, n); break;
+#endif
+			default: Scalar::transform(m, x, y, n);
+			}
+		}
+		/*!
+		Apply the affine transform m to n points stored one after the other
+		*/
+		inline void transform(const Affine& m, Vec2* points, std::size_t n)
+		{
+			switch (level())
+			{
+#if PATCHWORK_SIMD_X86
+			case AVX2: Avx2::transform(m, points, n); break;
+			case SSE2: Sse2::transform(m, points, n); break;
+#endif
+			default: Scalar::transform(m, points, n);
+			}
+		}
+	}
+}
@@ -0,0 +1,192 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <string>
+#include "Canvas.h"
+#include "SDL2/SDL.h"
+
+/*! \file Viewer.h
+\brief Header files containing the window the images are displayed in.
+
+The display loop sleeps in SDL_WaitEventTimeout instead of polling, so an open window costs nothing while its content doesn't change.
+*/
+
+namespace Patchwork
+{
+	/*!
+	A window displaying something until it is closed, drawn again only when needed :
+	when the window is exposed or resized, and when the content changed, checked when woken up by notify().
+	Frames are never drawn more often than the frame cap, and their drawing time is reported when the window is closed,
+	with the number of shapes drawn, culled and collapsed in the last frame.
+	The SDL video must be initialized.
+	*/
+	class Viewer
+	{
+	public:
+		/*!
+		Frame times of a viewer, drawing and presenting included
+		*/
+		struct Stats
+		{
+			Stats() : frames(0), total_ms(0), max_ms(0) {}
+			uint64_t frames; /*!< Number of frames drawn */
+			double total_ms; /*!< Total time spent drawing them */
+			double max_ms; /*!< Longest frame */
+			Canvas::Counters last; /*!< What became of the shapes of the last frame */
+		};
+
+		/*!
+		Open a window
+		\param title Title of the window
+		\param max_fps Frame cap, 0 for none
+		\param width Width of the window
+		\param height Height of the window
+		*/
+		Viewer(const std::string& title, int max_fps = 60, int width = 800, int height = 600)
+			: m_window(nullptr), m_renderer(nullptr), m_period_ms(max_fps > 0 ? 1000 / max_fps : 0)
+		{
+			SDL_CreateWindowAndRenderer(width, height, 0, &m_window, &m_renderer);
+			if (m_window)
+				SDL_SetWindowTitle(m_window, title.c_str());
+			Uint32 none = (Uint32)-1;
+			if (event_type() == none)
+			{
+				Uint32 type = SDL_RegisterEvents(1);
+				event_type().compare_exchange_strong(none, type);
+			}
+			++open_viewers();
+		}
+		/*!
+		Close the window, the renderer (and its textures) before it
+		*/
+		~Viewer()
+		{
+			--open_viewers();
+			if (m_renderer)
+				SDL_DestroyRenderer(m_renderer);
+			if (m_window)
+				SDL_DestroyWindow(m_window);
+		}
+		Viewer(const Viewer&) = delete;
+		Viewer& operator=(const Viewer&) = delete;
+
+		/*!
+		Display until the window is closed, then print the frame times.
+		\param draw Draw the content on the canvas, the whole canvas must be covered
+		\param revision Revision of the content, the content is drawn again when it changes
+		*/
+		Stats run(const std::function<void(Canvas&)>& draw, const std::function<uint64_t()>& revision)
+		{
+			Stats stats;
+			if (!m_renderer)
+			{
+				std::cout << "Can't open a window : " << SDL_GetError() << std::endl;
+				return stats;
+			}
+			typedef std::chrono::steady_clock Clock;
+			SDLCanvas canvas(m_renderer);
+			bool dirty = true;
+			uint64_t drawn = 0;
+			Clock::time_point last = Clock::now() - std::chrono::milliseconds(m_period_ms);
+			while (true)
+			{
+				//Sleep until an event, or until the frame cap lets the pending frame be drawn
+				int timeout = idle_timeout_ms;
+				if (dirty)
+				{
+					long long elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - last).count();
+					timeout = (int)std::max<long long>(0, m_period_ms - elapsed);
+				}
+				SDL_Event event;
+				bool quit = false;
+				bool woken = false;
+				if (SDL_WaitEventTimeout(&event, timeout))
+				{
+					do
+					{
+						if (event.type == SDL_QUIT ||
+							(event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_CLOSE))
+							quit = true;
+						else if (event.type == SDL_WINDOWEVENT &&
+							(event.window.event == SDL_WINDOWEVENT_EXPOSED || event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED))
+							dirty = true;
+						else if (event.type == event_type())
+							woken = true;
+					} while (SDL_PollEvent(&event));
+				}
+				else
+				{
+					//Timed out, look for a change nobody notified
+					woken = true;
+				}
+				if (quit)
+					break;
+				uint64_t current = revision();
+				if (woken && current != drawn)
+					dirty = true;
+				if (!dirty || Clock::now() - last < std::chrono::milliseconds(m_period_ms))
+					continue;
+
+				Clock::time_point start = Clock::now();
+				canvas.counters() = Canvas::Counters();
+				draw(canvas);
+				canvas.flush();
+				SDL_RenderPresent(m_renderer);
+				last = Clock::now();
+				double ms = std::chrono::duration<double, std::milli>(last - start).count();
+				++stats.frames;
+				stats.total_ms += ms;
+				stats.max_ms = std::max(stats.max_ms, ms);
+				stats.last = canvas.counters();
+				drawn = current;
+				dirty = false;
+			}
+			if (stats.frames)
+				std::cout << stats.frames << " frames drawn, " << stats.total_ms / stats.frames << " ms per frame on average, "
+					<< stats.max_ms << " ms at most" << std::endl
+					<< "Last frame : " << stats.last.drawn << " shapes drawn, " << stats.last.culled << " culled, "
+					<< stats.last.collapsed << " collapsed to a pixel" << std::endl;
+			return stats;
+		}
+		/*!
+		Wake every open viewer up so it checks whether its content changed. Can be called from any thread.
+		*/
+		static void notify()
+		{
+			if (open_viewers() > 0 && event_type() != (Uint32)-1)
+			{
+				SDL_Event event;
+				SDL_zero(event);
+				event.type = event_type();
+				SDL_PushEvent(&event);
+			}
+		}
+
+	private:
+		static const int idle_timeout_ms = 500; /*!< Longest sleep without checking the content, for changes nobody notified */
+		/*!
+		SDL event type sent by notify, registered by the first viewer
+		*/
+		static std::atomic<Uint32>& event_type()
+		{
+			static std::atomic<Uint32> type((Uint32)-1);
+			return type;
+		}
+		/*!
+		Number of viewers open, notify does nothing without one
+		*/
+		static std::atomic<int>& open_viewers()
+		{
+			static std::atomic<int> count(0);
+			return count;
+		}
+
+		SDL_Window* m_window; /*!< The window */
+		SDL_Renderer* m_renderer; /*!< Renderer of the window */
+		int m_period_ms; /*!< Shortest time between two frames */
+	};
+}
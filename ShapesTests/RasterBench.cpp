@@ -0,0 +1,146 @@
+#if _WIN32
+#include <stdio.h>
+#include <tchar.h>
+#endif
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "Raster.h"
+
+/*! \file RasterBench.cpp
+\brief Benchmark of the scanline rasterization against the per pixel tests it replaced, and of the SIMD crossings kernels.
+
+Both draw through a virtual call, one per pixel for the per pixel test (like SDL_RenderDrawPoint was) and one per row for the spans.
+*/
+
+using namespace Patchwork;
+
+/*!
+Counts the pixels drawn, so both methods do comparable work and nothing is optimized away
+*/
+class CountingSink : public SpanSink
+{
+public:
+	CountingSink() : calls(0), pixels(0) {}
+	virtual void point(int x, int y) { ++calls; ++pixels; }
+	void span(int y, int x0, int x1) { ++calls; pixels += x1 - x0; }
+	long long calls;
+	long long pixels;
+};
+
+void circle_per_pixel(CountingSink& sink, const Vec2& p, float radius)
+{
+	for (int i = -(int)(radius); i < (int)(radius); ++i)
+		for (int j = -(int)(radius); j < (int)(radius); ++j)
+			if (i*i + j*j <= radius*radius)
+				sink.point((int)(p.x + i), (int)(p.y + j));
+}
+
+void ellipse_per_pixel(CountingSink& sink, const Vec2& p, const Vec2& radius)
+{
+	for (int i = -(int)(radius.x); i < (int)(radius.x); ++i)
+		for (int j = -(int)(radius.y); j < (int)(radius.y); ++j)
+			if (j*j*radius.x*radius.x + i*i*radius.y*radius.y <= radius.x*radius.x*radius.y*radius.y)
+				sink.point((int)(p.x + i), (int)(p.y + j));
+}
+
+void polygon_per_pixel(CountingSink& sink, const std::vector<Vec2>& points, const Vec2& offset, int x0, int x1, int y0, int y1)
+{
+	int nvert = points.size();
+	for (int x = x0; x < x1; ++x)
+		for (int y = y0; y < y1; ++y)
+		{
+			Vec2 p((float)x, (float)y);
+			bool c = false;
+			for (int i = 0, j = nvert - 1; i < nvert; j = i++)
+			{
+				if (((points[i].y >= p.y) != (points[j].y >= p.y)) &&
+					(p.x <= (points[j].x - points[i].x) * (p.y - points[i].y) / (points[j].y - points[i].y) + points[i].x))
+					c = !c;
+			}
+			if (c)
+				sink.point((int)(x + offset.x), (int)(y + offset.y));
+		}
+}
+
+/*!
+Time f over the given number of runs, in milliseconds
+*/
+template <typename F>
+double time_ms(int runs, F f)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < runs; ++i)
+		f();
+	auto end = std::chrono::high_resolution_clock::now();
+	return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+void report(const std::string& name, double per_pixel, const CountingSink& a, double spans, const CountingSink& b)
+{
+	std::cout << name << std::endl;
+	std::cout << "\tper pixel : " << per_pixel << " ms, " << a.calls << " calls, " << a.pixels << " pixels" << std::endl;
+	std::cout << "\tspans     : " << spans << " ms, " << b.calls << " calls, " << b.pixels << " pixels" << std::endl;
+	std::cout << "\tspeedup   : " << per_pixel / spans << "x" << (a.pixels == b.pixels ? "" : " (COVERAGE DIFFERS)") << std::endl;
+}
+
+#if _WIN32
+int _tmain(int argc, _TCHAR* argv[])
+#else
+int main()
+#endif
+{
+	const int runs = 20;
+	const float radii[] = { 10.f, 100.f, 1000.f };
+	for (float r : radii)
+	{
+		CountingSink a, b;
+		//Away from the axes, where the truncation to pixels maps two points to the same pixel and the counts would differ
+		Vec2 p(1200.5f, 1100.25f);
+		double per_pixel = time_ms(runs, [&]() { circle_per_pixel(a, p, r); });
+		double spans = time_ms(runs, [&]() { rasterize_circle(b, p, r); });
+		report("Circle radius " + std::to_string((int)r), per_pixel, a, spans, b);
+
+		CountingSink c, d;
+		Vec2 radius(r, r / 2);
+		per_pixel = time_ms(runs, [&]() { ellipse_per_pixel(c, p, radius); });
+		spans = time_ms(runs, [&]() { rasterize_ellipse(d, p, radius); });
+		report("Ellipse radii " + std::to_string((int)radius.x) + " " + std::to_string((int)radius.y), per_pixel, c, spans, d);
+	}
+
+	//Stars of radius 200, the per pixel test walks every edge for every pixel
+	const int vertices[] = { 8, 100, 1000 };
+	for (int n : vertices)
+	{
+		std::vector<Vec2> star;
+		for (int i = 0; i < n; ++i)
+		{
+			float r = (i % 2) ? 100.f : 200.f;
+			star.push_back(Vec2(r * (float)cos(i * 2 * PI / n), r * (float)sin(i * 2 * PI / n)));
+		}
+		CountingSink a, b;
+		Vec2 offset(1200.f, 1100.f);
+		int polygon_runs = n < 1000 ? runs : 1;
+		double per_pixel = time_ms(polygon_runs, [&]() { polygon_per_pixel(a, star, offset, -201, 201, -201, 201); });
+		double spans = time_ms(polygon_runs, [&]() { rasterize_polygon(b, star, offset, -201, 201, -201, 201); });
+		report("Polygon " + std::to_string(n) + " vertices", per_pixel, a, spans, b);
+	}
+
+	//Scanlines of a star of 1000 vertices at each instruction set available, the crossings of every row being computed by the SIMD kernels
+	const char* levels[] = { "scalar", "SSE2", "AVX2" };
+	std::vector<Vec2> star;
+	for (int i = 0; i < 1000; ++i)
+	{
+		float r = (i % 2) ? 100.f : 200.f;
+		star.push_back(Vec2(r * (float)cos(i * 2 * PI / 1000), r * (float)sin(i * 2 * PI / 1000)));
+	}
+	for (int level = Simd::SCALAR; level <= Simd::detect(); ++level)
+	{
+		Simd::set_level((Simd::Level)level);
+		CountingSink sink;
+		double ms = time_ms(runs, [&]() { rasterize_polygon(sink, star, Vec2(1200.f, 1100.f), -201, 201, -201, 201); });
+		std::cout << "Polygon 1000 vertices " << levels[level] << " : " << ms << " ms, " << sink.pixels << " pixels" << std::endl;
+	}
+	return 0;
+}
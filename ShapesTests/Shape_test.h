@@ -1,6 +1,11 @@
+#include <set>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
 #include "Shape.h"
 #include "Asserts.h"
 #include "Factory.h"
+#include "Message.hpp"
 
 namespace Shape_test
 {
@@ -118,6 +123,1210 @@ namespace Shape_test
 		std::cout << std::endl << "Test class Line  : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
 	}
 
+	static void test_binary()
+	{
+		int passed_test = 0;
+		int nb_of_test = 5;
+
+		std::cout << "Begin test suit for binary encoding" << std::endl << std::endl;
+
+		std::string s;
+		Circle c = Circle(Vec2(0.5f, -1.f), 10.f, Color(255, 0, 300));
+		c.encode(s);
+		passed_test += test_assert(s.size() == 17, "Circle size");
+
+		s.clear();
+		write_varint(s, 300);
+		BinaryReader reader(s.data(), s.size());
+		passed_test += test_assert(s.size() == 2 && reader.read_varint() == 300 && reader.ok(), "Varint");
+
+		Image im;
+		im.add_component(new Circle(c));
+		im.add_component(new Polygon({ { 0.25f, 1 }, { -1, 1 }, { -1, 0 } }, Color(1, 2, 3)));
+		im.add_component(new Line(Vec2(1, 2), Vec2(3, 4), Color(4, 5, 6)));
+		im.add_component(new Ellipse(Vec2(7, 8), Vec2(9, 10), Color(7, 8, 9)));
+		im.annotate("hello world");
+		std::string binary, text, text2;
+		im.serialize(binary, BINARY);
+		im.serialize(text, TEXT);
+		passed_test += test_assert(binary[0] == binary_marker && binary.size() < text.size(), "Image size");
+
+		Image im2;
+		im2.deserialize(binary);
+		im2.serialize(text2);
+		//The color channel above 255 is clamped on the wire
+		passed_test += test_assert(text2 == " circle 0.50 -1.00 10.00 255 0 255 polygon 3 0.25 1.00 -1.00 1.00 -1.00 0.00 1 2 3 line 1.00 2.00 3.00 4.00 4 5 6 ellipse 7.00 8.00 9.00 10.00 7 8 9 annotation 11 hello world", "Round trip");
+
+		Image im3;
+		im3.deserialize(binary.substr(0, binary.size() - 3));
+		passed_test += test_assert(im3.components().size() == 4 && im3.get_annotation().empty(), "Truncated payload");
+
+		std::cout << std::endl << "Test binary encoding : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
+	static void test_delta()
+	{
+		int passed_test = 0;
+		int nb_of_test = 7;
+
+		std::cout << "Begin test suit for delta synchronization" << std::endl << std::endl;
+
+		Image client;
+		for (int i = 0; i < 50; i++)
+			client.add_component(new Circle(Vec2((float)i, 0.f), 5.f, Color(i, 0, 0)));
+		std::string s;
+		passed_test += test_assert(!client.serialize_delta(s) && s.empty(), "No delta before acknowledgment");
+
+		//Server receives the whole image and acknowledges it
+		Image server;
+		std::string full;
+		client.serialize(full, BINARY);
+		server.deserialize(full);
+		client.acknowledge(server.received_version());
+		passed_test += test_assert(server.received_version() == client.current_version() && server.components().size() == 50, "Full image");
+
+		//Edit the client image : one modified, one removed, one added
+		client.components().at(3)->translate(Vec2(1.f, 1.f));
+		client.mark_changed(3);
+		client.remove_component(10);
+		client.add_component(new Polygon({ { 0, 0 }, { 1, 0 }, { 1, 1 } }, Color(0, 0, 255)));
+		client.annotate("edited");
+		std::string delta;
+		passed_test += test_assert(client.serialize_delta(delta) && delta.size() < full.size() / 10, "Delta size");
+
+		server.deserialize(delta);
+		std::string a, b;
+		client.serialize(a);
+		server.serialize(b);
+		passed_test += test_assert(a == b && server.received_version() == client.current_version(), "Delta applied");
+
+		//A delta based on a version the server never received is ignored
+		Image other;
+		other.deserialize(full);
+		client.acknowledge(server.received_version());
+		client.add_component(new Circle(Vec2(0, 0), 1.f, Color()));
+		delta.clear();
+		client.serialize_delta(delta);
+		other.deserialize(delta);
+		passed_test += test_assert(other.components().size() == 50, "Delta from unknown base");
+
+		//Removals acknowledged by the server are not sent again
+		server.deserialize(delta);
+		client.acknowledge(server.received_version());
+		delta.clear();
+		client.serialize_delta(delta);
+		passed_test += test_assert(delta.size() == 5 && server.components().size() == 51, "Acknowledged history");
+
+		//A peer acknowledging an older version after ignoring a delta gets the whole image, then deltas again
+		client.acknowledge(other.received_version());
+		delta.clear();
+		bool no_delta = !client.serialize_delta(delta);
+		std::string resync;
+		client.serialize(resync, BINARY);
+		other.deserialize(resync);
+		client.acknowledge(other.received_version());
+		client.remove_component(0);
+		delta.clear();
+		bool sent = client.serialize_delta(delta);
+		other.deserialize(delta);
+		a.clear();
+		b.clear();
+		client.serialize(a);
+		other.serialize(b);
+		passed_test += test_assert(no_delta && sent && a == b && other.received_version() == client.current_version(), "Resync after an ignored delta");
+
+		std::cout << std::endl << "Test delta synchronization : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
+	typedef std::set<std::pair<int, int>> Pixels;
+
+	/*!
+	Sink recording every pixel covered by the spans
+	*/
+	class PixelSink : public SpanSink
+	{
+	public:
+		void span(int y, int x0, int x1)
+		{
+			for (int x = x0; x < x1; ++x)
+				pixels.insert(std::make_pair(x, y));
+		}
+		Pixels pixels;
+	};
+
+	/*!
+	The pixels the circle covered when every pixel of its bounding square was tested
+	*/
+	static Pixels circle_pixels(const Vec2& p, float radius)
+	{
+		Pixels pixels;
+		for (int i = -(int)(radius); i < (int)(radius); ++i)
+			for (int j = -(int)(radius); j < (int)(radius); ++j)
+				if (i*i + j*j <= radius*radius)
+					pixels.insert(std::make_pair((int)(p.x + i), (int)(p.y + j)));
+		return pixels;
+	}
+
+	/*!
+	The pixels the ellipse covered when every pixel of its bounding box was tested
+	*/
+	static Pixels ellipse_pixels(const Vec2& p, const Vec2& radius)
+	{
+		Pixels pixels;
+		for (int i = -(int)(radius.x); i < (int)(radius.x); ++i)
+			for (int j = -(int)(radius.y); j < (int)(radius.y); ++j)
+				if (j*j*radius.x*radius.x + i*i*radius.y*radius.y <= radius.x*radius.x*radius.y*radius.y)
+					pixels.insert(std::make_pair((int)(p.x + i), (int)(p.y + j)));
+		return pixels;
+	}
+
+	/*!
+	The pixels the polygon covered when every pixel of its bounding box was tested with the crossing test
+	*/
+	static Pixels polygon_pixels(const std::vector<Vec2>& points, int x0, int x1, int y0, int y1)
+	{
+		Pixels pixels;
+		int nvert = points.size();
+		for (int x = x0; x < x1; ++x)
+			for (int y = y0; y < y1; ++y)
+			{
+				Vec2 p((float)x, (float)y);
+				bool c = false;
+				for (int i = 0, j = nvert - 1; i < nvert; j = i++)
+				{
+					if (((points[i].y >= p.y) != (points[j].y >= p.y)) &&
+						(p.x <= (points[j].x - points[i].x) * (p.y - points[i].y) / (points[j].y - points[i].y) + points[i].x))
+						c = !c;
+				}
+				if (c)
+					pixels.insert(std::make_pair(x, y));
+			}
+		return pixels;
+	}
+
+	static void test_raster()
+	{
+		int passed_test = 0;
+		int nb_of_test = 7;
+
+		std::cout << "Begin test suit for scanline rasterization" << std::endl << std::endl;
+
+		const Vec2 centers[] = { Vec2(400, 300), Vec2(10.5f, -3.25f), Vec2(-120.75f, 77.1f) };
+		const float radii[] = { 0.5f, 1.f, 1.5f, 7.3f, 35.f, 99.99f, 250.f };
+
+		bool same = true;
+		for (auto& p : centers)
+			for (float r : radii)
+			{
+				PixelSink sink;
+				rasterize_circle(sink, p, r);
+				same = same && sink.pixels == circle_pixels(p, r);
+			}
+		passed_test += test_assert(same, "Circle coverage");
+
+		same = true;
+		for (auto& p : centers)
+			for (float rx : radii)
+				for (float ry : radii)
+				{
+					PixelSink sink;
+					rasterize_ellipse(sink, p, Vec2(rx, ry));
+					same = same && sink.pixels == ellipse_pixels(p, Vec2(rx, ry));
+				}
+		passed_test += test_assert(same, "Ellipse coverage");
+
+		//One span per row
+		class CountSink : public SpanSink
+		{
+		public:
+			CountSink() : spans(0) {}
+			void span(int, int, int) { ++spans; }
+			int spans;
+		} count;
+		rasterize_circle(count, Vec2(0, 0), 50.f);
+		passed_test += test_assert(count.spans == 100, "Circle spans");
+
+		PixelSink empty;
+		rasterize_circle(empty, Vec2(0, 0), 0.f);
+		rasterize_ellipse(empty, Vec2(0, 0), Vec2(10.f, 0.5f));
+		passed_test += test_assert(empty.pixels.empty(), "Degenerate shapes");
+
+		std::vector<std::vector<Vec2>> polygons = {
+			{ { 0, 0 }, { 50, 0 }, { 50, 50 }, { 0, 50 } },
+			{ { 0.5f, 0.5f }, { 40.25f, 3.75f }, { 20.1f, 30.9f }, { 35.f, 60.f }, { -12.3f, 44.4f } },
+			{ { 0, 0 }, { 40, 40 }, { 40, 0 }, { 0, 40 } },
+			{ { -20, -20 }, { 20, -20 }, { 20, 20 }, { -20, 20 }, { -10, -10 }, { 10, -10 }, { 10, 10 }, { -10, 10 } }
+		};
+		//A star with many vertices
+		std::vector<Vec2> star;
+		for (int i = 0; i < 1000; ++i)
+		{
+			float r = (i % 2) ? 20.f : 60.f;
+			star.push_back(Vec2(r * (float)cos(i * 2 * PI / 1000), r * (float)sin(i * 2 * PI / 1000)));
+		}
+		polygons.push_back(star);
+		same = true;
+		for (auto& points : polygons)
+		{
+			PixelSink sink;
+			rasterize_polygon(sink, points, Vec2(0, 0), -70, 70, -70, 70);
+			same = same && sink.pixels == polygon_pixels(points, -70, 70, -70, 70);
+		}
+		passed_test += test_assert(same, "Polygon coverage");
+
+		//Only the given columns and rows are covered, shifted by the offset
+		PixelSink clipped;
+		rasterize_polygon(clipped, polygons[0], Vec2(100, 200), 10, 20, 5, 15);
+		Pixels expected;
+		for (auto pixel : polygon_pixels(polygons[0], 10, 20, 5, 15))
+			expected.insert(std::make_pair(pixel.first + 100, pixel.second + 200));
+		passed_test += test_assert(clipped.pixels == expected && expected.size() == 100, "Polygon clipping");
+
+		PixelSink flat;
+		rasterize_polygon(flat, { { 0, 0 }, { 50, 0 }, { 50, 0.5f } }, Vec2(0, 0), -70, 70, -70, 70);
+		rasterize_polygon(flat, {}, Vec2(0, 0), -70, 70, -70, 70);
+		passed_test += test_assert(flat.pixels.empty(), "Degenerate polygons");
+
+		std::cout << std::endl << "Test scanline rasterization : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
+	static void test_framebuffer()
+	{
+		int passed_test = 0;
+		int nb_of_test = 7;
+
+		std::cout << "Begin test suit for Framebuffer" << std::endl << std::endl;
+
+		//A shape in a framebuffer covers the pixels of its spans, relative to the center
+		Framebuffer fb(200, 100);
+		fb.clear(Color(255, 255, 255));
+		Circle c(Vec2(10.5f, -5.f), 20.f, Color(255, 0, 0));
+		c.display(fb, 1.f);
+		PixelSink sink;
+		rasterize_circle(sink, Vec2(110.5f, 45.f), 20.f);
+		int red = 0;
+		bool same = true;
+		for (int y = 0; y < fb.height(); ++y)
+			for (int x = 0; x < fb.width(); ++x)
+				if (fb.pixel(x, y) == Color(255, 0, 0))
+				{
+					++red;
+					same = same && sink.pixels.count(std::make_pair(x, y));
+				}
+		passed_test += test_assert(same && red == (int)sink.pixels.size(), "Circle pixels");
+
+		//Shapes partly outside are clipped
+		Framebuffer small(10, 10);
+		Ellipse(Vec2(0, 0), Vec2(50, 30), Color(0, 0, 255)).display(small, 1.f);
+		Polygon({ { -100, -100 }, { 100, -100 }, { 100, 100 } }, Color(0, 255, 0)).display(small, 1.f);
+		passed_test += test_assert(small.pixel(0, 0) == Color(0, 0, 255) && small.pixel(9, 0) == Color(0, 255, 0), "Clipping");
+
+		//Lines include both ends
+		Framebuffer lines(10, 10);
+		lines.set_color(Color(0, 0, 0));
+		lines.line(1, 1, 8, 4);
+		passed_test += test_assert(lines.pixel(1, 1) == Color(0, 0, 0) && lines.pixel(8, 4) == Color(0, 0, 0) && lines.pixel(8, 5) == Color(255, 255, 255), "Line");
+
+		//Tiled rendering with several threads gives the same pixels, overlapping shapes still painted in order
+		Image image;
+		for (int i = 0; i < 200; ++i)
+		{
+			Vec2 p((float)((i * 37) % 600 - 300), (float)((i * 53) % 400 - 200));
+			Color color((i * 40) % 256, (i * 90) % 256, (i * 150) % 256);
+			switch (i % 4)
+			{
+				case 0: image.add_component(new Circle(p, 5.f + i % 30, color)); break;
+				case 1: image.add_component(new Ellipse(p, Vec2(40.f, 10.f + i % 20), color)); break;
+				case 2: image.add_component(new Polygon({ p, p + Vec2(60, 10), p + Vec2(20, 50) }, color)); break;
+				case 3: image.add_component(new Line(p, Vec2(-80.f, (float)(i % 50)), color)); break;
+			}
+		}
+		Image* nested = new Image();
+		nested->add_component(new Circle(Vec2(0, 0), 100.f, Color(1, 2, 3)));
+		image.add_component(nested);
+		image.add_component(new Line(Vec2(-200, 150), Vec2(0, -300), Color(4, 5, 6)));
+		Framebuffer serial(640, 480), tiled(640, 480);
+		image.display(serial);
+		image.display_parallel(tiled, 4, 32);
+		passed_test += test_assert(memcmp(serial.data(), tiled.data(), 640 * 480 * 4) == 0, "Tiled rendering");
+
+		//A view only draws inside its rectangle
+		Framebuffer view(tiled, 10, 10, 20, 20);
+		view.clear(Color(7, 8, 9));
+		passed_test += test_assert(tiled.pixel(10, 10) == Color(7, 8, 9) && tiled.pixel(19, 19) == Color(7, 8, 9) && !(tiled.pixel(20, 20) == Color(7, 8, 9)), "View clipping");
+
+		//Files
+		std::string ppm_path = "framebuffer_test.ppm", png_path = "framebuffer_test.png";
+		fb.write_ppm(ppm_path);
+		fb.write_png(png_path);
+		std::ifstream ppm(ppm_path.c_str(), std::ios::binary);
+		std::string ppm_data((std::istreambuf_iterator<char>(ppm)), std::istreambuf_iterator<char>());
+		passed_test += test_assert(ppm_data.compare(0, 15, "P6\n200 100\n255\n") == 0 && ppm_data.size() == 15 + 200 * 100 * 3, "PPM");
+		std::ifstream png(png_path.c_str(), std::ios::binary);
+		std::string png_data((std::istreambuf_iterator<char>(png)), std::istreambuf_iterator<char>());
+		//signature, IHDR, IDAT holding the rows in 2 stored blocks, IEND
+		std::size_t raw = (200 * 4 + 1) * 100;
+		passed_test += test_assert(png_data.compare(0, 8, "\x89PNG\r\n\x1a\n") == 0 && png_data.size() == 8 + 25 + 12 + 2 + 2 * 5 + raw + 4 + 12, "PNG");
+		ppm.close();
+		png.close();
+		std::remove(ppm_path.c_str());
+		std::remove(png_path.c_str());
+
+		std::cout << std::endl << "Test Framebuffer : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
+	static void test_simd()
+	{
+		int passed_test = 0;
+		int nb_of_test = 2;
+
+		std::cout << "Begin test suit for SIMD kernels (level " << Simd::level() << ")" << std::endl << std::endl;
+
+		//Every level available must give the very same results as the scalar one, odd sizes check the remainders
+		Simd::Level best = Simd::detect();
+
+		//Edges of a star, the crossings must be bitwise equal to the scalar expression
+		std::vector<float> ax, ay, bx, by;
+		for (int i = 0; i < 37; ++i)
+		{
+			ax.push_back(60.f * (float)cos(i * 0.17));
+			ay.push_back(60.f * (float)sin(i * 0.17) - 0.5f);
+			bx.push_back(20.f * (float)cos(i * 0.31 + 1));
+			by.push_back(20.f * (float)sin(i * 0.31 + 1) + 0.25f);
+		}
+		std::vector<float> expected(ax.size()), crossings(ax.size());
+		bool same = true;
+		for (int level = Simd::SCALAR; level <= best; ++level)
+		{
+			Simd::set_level((Simd::Level)level);
+			for (int y = -20; y <= 20; ++y)
+			{
+				Simd::crossings(ax.data(), ay.data(), bx.data(), by.data(), ax.size(), (float)y, crossings.data());
+				for (std::size_t k = 0; k < ax.size(); ++k)
+					expected[k] = Raster::crossing(ax[k], ay[k], bx[k], by[k], (float)y);
+				same = same && memcmp(crossings.data(), expected.data(), ax.size() * sizeof(float)) == 0;
+			}
+		}
+		passed_test += test_assert(same, "Crossings");
+
+		//The scanlines of a polygon, which go through the crossings kernel, against the crossing test of Polygon::isPointInPolygon
+		std::vector<Vec2> points = { { 0.5f, 0.5f }, { 40.25f, 3.75f }, { 20.1f, 30.9f }, { 35.f, 60.f }, { -12.3f, 44.4f } };
+		Pixels expected_pixels = polygon_pixels(points, -15, 46, -2, 63);
+		same = true;
+		for (int level = Simd::SCALAR; level <= best; ++level)
+		{
+			Simd::set_level((Simd::Level)level);
+			PixelSink sink;
+			rasterize_polygon(sink, points, Vec2(0, 0), -15, 46, -2, 63);
+			same = same && sink.pixels == expected_pixels;
+		}
+		passed_test += test_assert(same, "Polygon coverage at every level");
+		Simd::set_level(best);
+
+		std::cout << std::endl << "Test SIMD : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
+	static void test_cache()
+	{
+		int passed_test = 0;
+		int nb_of_test = 5;
+
+		std::cout << "Begin test suit for render cache" << std::endl << std::endl;
+
+		Image img;
+		img.add_component(new Circle(Vec2(0, 0), 20.f, Color(255, 0, 0)));
+		Framebuffer fb(200, 100);
+		img.display_cached(fb);
+		passed_test += test_assert(fb.pixel(100, 50) == Color(255, 0, 0) && fb.pixel(0, 0) == Color(255, 255, 255), "First display");
+
+		//A component moved behind the image's back is not seen : the rendering in cache is reused
+		uint64_t revision = img.revision();
+		img.components().at(0)->translate(Vec2(30, 0));
+		Framebuffer same(200, 100);
+		img.display_cached(same);
+		passed_test += test_assert(img.revision() == revision && same.pixel(100, 50) == Color(255, 0, 0), "Cache reused");
+
+		img.mark_changed(0);
+		Framebuffer moved(200, 100);
+		img.display_cached(moved);
+		passed_test += test_assert(img.revision() > revision && moved.pixel(100, 50) == Color(255, 255, 255), "Cache invalidated");
+
+		//Every edit, including a nested image's, gives a new revision
+		Image* nested = new Image();
+		nested->add_component(new Circle(Vec2(0, 0), 5.f, Color(0, 0, 255)));
+		img.add_component(nested);
+		revision = img.revision();
+		nested->translate(Vec2(1, 1));
+		bool newer = img.revision() > revision;
+		revision = img.revision();
+		std::string serial;
+		img.serialize(serial, BINARY);
+		Image copy;
+		copy.add_component(new Circle(Vec2(0, 0), 1.f, Color()));
+		uint64_t copy_revision = copy.revision();
+		copy.deserialize(serial);
+		passed_test += test_assert(newer && copy.revision() > copy_revision, "Revisions");
+
+		//A canvas of another size gets its own rendering
+		Framebuffer other(100, 100);
+		copy.display_cached(other);
+		passed_test += test_assert(other.pixel(50, 50) == Color(0, 0, 255), "Canvas size");
+
+		std::cout << std::endl << "Test render cache : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
+	static void test_view()
+	{
+		int passed_test = 0;
+		int nb_of_test = 3;
+
+		std::cout << "Begin test suit for view transform" << std::endl << std::endl;
+
+		//Displaying through a scaled view gives the pixels of a copy transformed by an homothety
+		Circle circle(Vec2(30.5f, -12.f), 25.f, Color(255, 0, 0));
+		Ellipse ellipse(Vec2(-40.f, 20.25f), Vec2(30.f, 12.5f), Color(0, 255, 0));
+		Polygon polygon({ { 0.5f, 0.5f }, { 40.25f, 3.75f }, { 20.1f, 30.9f }, { 35.f, 60.f }, { -12.3f, 44.4f } }, Color(0, 0, 255));
+		const float ratios[] = { 0.37f, 1.f, 2.5f };
+		bool same = true;
+		for (float ratio : ratios)
+		{
+			Circle circle_copy(circle);
+			Ellipse ellipse_copy(ellipse);
+			Polygon polygon_copy(polygon);
+			std::pair<Shape*, Shape*> shapes[] = { { &circle, &circle_copy }, { &ellipse, &ellipse_copy }, { &polygon, &polygon_copy } };
+			for (auto& shape : shapes)
+			{
+				Framebuffer viewed(200, 160), copied(200, 160);
+				shape.first->display(viewed, ratio);
+				shape.second->homothety(Vec2(0, 0), ratio);
+				shape.second->display(copied, 1.f);
+				same = same && memcmp(viewed.data(), copied.data(), 200 * 160 * 4) == 0;
+			}
+		}
+		passed_test += test_assert(same, "Same pixels as an homothety");
+
+		//A view with an offset moves the shape
+		Framebuffer centered(100, 100), moved(100, 100);
+		Circle small(Vec2(0, 0), 5.f, Color(255, 0, 0));
+		small.display(centered, View(1.f, Vec2(50, 50)));
+		small.display(moved, View(2.f, Vec2(20, 30)));
+		passed_test += test_assert(centered.pixel(50, 50) == Color(255, 0, 0) && moved.pixel(20, 30) == Color(255, 0, 0)
+			&& moved.pixel(29, 30) == Color(255, 0, 0) && moved.pixel(50, 50) == Color(255, 255, 255), "Offset");
+
+		//The buffers of the rasterizer are kept from one shape to the next
+		Framebuffer fb(200, 160);
+		polygon.display(fb, 0.5f);
+		const Vec2* points = Raster::scratch().points.data();
+		const Raster::Edge* edges = Raster::scratch().edges.data();
+		polygon.display(fb, 0.75f);
+		passed_test += test_assert(points == Raster::scratch().points.data() && edges == Raster::scratch().edges.data(), "Buffers reused");
+
+		std::cout << std::endl << "Test view transform : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
+	static void test_culling()
+	{
+		int passed_test = 0;
+		int nb_of_test = 4;
+
+		std::cout << "Begin test suit for culling" << std::endl << std::endl;
+
+		//Shapes outside of the canvas are skipped
+		Image img;
+		img.add_component(new Circle(Vec2(0, 0), 10.f, Color(255, 0, 0)));
+		img.add_component(new Circle(Vec2(500, 0), 10.f, Color(0, 255, 0)));
+		img.add_component(new Polygon({ { -300, -300 }, { -250, -300 }, { -250, -250 } }, Color(0, 0, 255)));
+		Framebuffer fb(100, 100);
+		img.display(fb, View(1.f, Vec2(50, 50)));
+		passed_test += test_assert(fb.counters().drawn == 1 && fb.counters().culled == 2 && fb.pixel(50, 50) == Color(255, 0, 0), "Off-screen shapes culled");
+
+		//Shapes smaller than a pixel become a pixel of their color
+		Framebuffer far(100, 100);
+		img.display(far, View(0.01f, Vec2(50, 50)));
+		passed_test += test_assert(far.counters().collapsed == 3 && far.counters().drawn == 0 && far.pixel(50, 50) == Color(255, 0, 0), "Sub-pixel shapes collapsed");
+
+		//A nested image is culled or collapsed as a whole, with the color of its last shape
+		Image patchwork;
+		Image* nested = new Image();
+		for (int i = 0; i < 100; ++i)
+			nested->add_component(new Circle(Vec2((float)i, 0), 3.f, Color(i, 0, 0)));
+		patchwork.add_component(nested);
+		Framebuffer zoomed(100, 100);
+		patchwork.display(zoomed, View(0.005f, Vec2(20, 20)));
+		Framebuffer away(100, 100);
+		patchwork.display(away, View(1.f, Vec2(-500, 20)));
+		passed_test += test_assert(zoomed.counters().collapsed == 1 && zoomed.pixel(20, 20) == Color(99, 0, 0) && away.counters().culled == 1, "Nested images");
+
+		//The tiled renderer culls the same shapes and draws the same pixels
+		Framebuffer tiled(100, 100);
+		Image all;
+		all.add_component(&img);
+		all.add_component(&patchwork);
+		all.display_parallel(tiled, 4, 16);
+		Framebuffer sequential(100, 100);
+		all.display(sequential);
+		const Canvas::Counters& a = tiled.counters();
+		const Canvas::Counters& b = sequential.counters();
+		passed_test += test_assert(a.drawn == b.drawn && a.culled == b.culled && a.collapsed == b.collapsed
+			&& memcmp(tiled.data(), sequential.data(), 100 * 100 * 4) == 0, "Tiled rendering");
+		all.components().clear();
+
+		std::cout << std::endl << "Test culling : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
+	static void test_index()
+	{
+		int passed_test = 0;
+		int nb_of_test = 4;
+
+		std::cout << "Begin test suit for spatial index" << std::endl << std::endl;
+
+		//Items are found once, whatever the number of cells they cover
+		Grid<int> grid(10.f);
+		int items[3];
+		grid.insert(&items[0], 0, 0, 5, 5);
+		grid.insert(&items[1], 0, 0, 35, 35);
+		grid.insert(&items[2], 100, 100, 105, 105);
+		std::vector<int*> found;
+		grid.query(-50, -50, 50, 50, found);
+		bool once = found.size() == 2 && std::count(found.begin(), found.end(), &items[1]) == 1;
+		grid.remove(&items[1]);
+		found.clear();
+		grid.query(20, 20, 200, 200, found);
+		passed_test += test_assert(once && found.size() == 1 && found[0] == &items[2], "Grid queries");
+
+		//Queries answer the same with and without the index, through every kind of edit
+		Image indexed, scanned;
+		indexed.enable_index(16.f);
+		for (int i = 0; i < 50; ++i)
+		{
+			indexed.add_component(new Circle(Vec2((float)(i * 13 % 200), (float)(i * 7 % 150)), 4.f, Color(i, 0, 0)));
+			scanned.add_component(new Circle(Vec2((float)(i * 13 % 200), (float)(i * 7 % 150)), 4.f, Color(i, 0, 0)));
+		}
+		indexed.add_component(new Line(Vec2(0, 0), Vec2(300, 300), Color()));
+		scanned.add_component(new Line(Vec2(0, 0), Vec2(300, 300), Color()));
+		auto same = [&](const BoundingBox& region)
+		{
+			std::vector<Shape*> a = indexed.query(region), b = scanned.query(region);
+			if (a.size() != b.size())
+				return false;
+			for (std::size_t i = 0; i < a.size(); ++i)
+				if (a[i]->id() != b[i]->id())
+					return false;
+			return true;
+		};
+		BoundingBox region;
+		region.x_min = 60;
+		region.x_max = 120;
+		region.y_min = 20;
+		region.y_max = 80;
+		bool ok = same(region);
+		indexed.translate(Vec2(30, -10));
+		scanned.translate(Vec2(30, -10));
+		ok = ok && same(region);
+		indexed.rotate(Vec2(0, 0), 0.5);
+		scanned.rotate(Vec2(0, 0), 0.5);
+		ok = ok && same(region);
+		indexed.remove_component(3);
+		scanned.remove_component(3);
+		static_cast<Circle*>(indexed.components()[7])->translate(Vec2(80, 40));
+		static_cast<Circle*>(scanned.components()[7])->translate(Vec2(80, 40));
+		indexed.mark_changed(7);
+		scanned.mark_changed(7);
+		ok = ok && same(region) && !indexed.query(region).empty();
+		passed_test += test_assert(ok, "Region queries");
+
+		//Hit testing finds the shape painted last under the point
+		Image picked;
+		picked.enable_index();
+		picked.add_component(new Polygon({ { 0, 0 }, { 40, 0 }, { 40, 40 }, { 0, 40 } }, Color(255, 0, 0)));
+		picked.add_component(new Circle(Vec2(30, 30), 5.f, Color(0, 255, 0)));
+		picked.add_component(new Ellipse(Vec2(100, 0), Vec2(10, 2), Color(0, 0, 255)));
+		picked.add_component(new Line(Vec2(200, 0), Vec2(0, 50), Color()));
+		Shape* top = picked.component_at(Vec2(31, 31));
+		Shape* under = picked.component_at(Vec2(10, 10));
+		passed_test += test_assert(top && top->type() == Shape::CIRCLE && under && under->type() == Shape::POLYGON
+			&& picked.component_at(Vec2(100, 1))->type() == Shape::ELLIPSE && !picked.component_at(Vec2(100, 3))
+			&& picked.component_at(Vec2(200.2f, 25))->type() == Shape::LINE && !picked.component_at(Vec2(-5, -5)), "Hit testing");
+
+		//Drawing through the index skips the same shapes and draws the same pixels
+		Framebuffer a(64, 64), b(64, 64);
+		indexed.display(a, View(2.f, Vec2(-100, -20)));
+		scanned.display(b, View(2.f, Vec2(-100, -20)));
+		Framebuffer c(64, 64), d(64, 64);
+		indexed.display_parallel(c, 2, 16);
+		scanned.display_parallel(d, 2, 16);
+		passed_test += test_assert(a.counters().culled > 0 && a.counters().culled == b.counters().culled && a.counters().drawn == b.counters().drawn
+			&& memcmp(a.data(), b.data(), 64 * 64 * 4) == 0 && memcmp(c.data(), d.data(), 64 * 64 * 4) == 0, "Indexed rendering");
+
+		std::cout << std::endl << "Test spatial index : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
+	static void test_bounding_box()
+	{
+		int passed_test = 0;
+		int nb_of_test = 4;
+
+		std::cout << "Begin test suit for bounding boxes" << std::endl << std::endl;
+
+		//Boxes are floats, far from the origin too
+		Image empty;
+		Image far;
+		far.add_component(new Circle(Vec2(50000.5f, -60000.f), 0.25f, Color()));
+		BoundingBox bb = far.bounding_box();
+		passed_test += test_assert(empty.bounding_box().empty() && empty.area() == 0.f
+			&& bb.x_min == 50000.25f && bb.x_max == 50000.75f && bb.y_max == -59999.75f, "Float boxes");
+
+		//The box in cache follows additions, translations and removals
+		Image img;
+		img.add_component(new Circle(Vec2(0, 0), 10.f, Color()));
+		img.add_component(new Circle(Vec2(5, 5), 1.f, Color()));
+		bb = img.bounding_box();
+		img.add_component(new Polygon({ { 0, 0 }, { 100, 0 }, { 100, 20 } }, Color()));
+		BoundingBox grown = img.bounding_box();
+		img.translate(Vec2(10, 10));
+		BoundingBox moved = img.bounding_box();
+		img.remove_component(1);
+		BoundingBox kept = img.bounding_box();
+		img.remove_component(1);
+		BoundingBox shrunk = img.bounding_box();
+		passed_test += test_assert(bb.x_max == 10.f && grown.x_max == 100.f && moved.x_max == 110.f && moved.y_min == 0.f
+			&& kept.x_max == 110.f && shrunk.x_max == 20.f && shrunk.y_max == 20.f, "Incremental box");
+
+		//Modified components and other transforms give a new box
+		img.components().at(0)->translate(Vec2(-50, 0));
+		img.mark_changed(0);
+		BoundingBox changed = img.bounding_box();
+		img.homothety(Vec2(0, 0), 2.f);
+		BoundingBox scaled = img.bounding_box();
+		passed_test += test_assert(changed.x_min == -50.f && changed.x_max == -30.f && scaled.x_min == -100.f && scaled.y_max == 40.f, "Shrinking edits");
+
+		//Editing a nested image changes the box of the image holding it
+		Image patchwork;
+		Image* nested = new Image();
+		nested->add_component(new Circle(Vec2(0, 0), 1.f, Color()));
+		patchwork.add_component(nested);
+		BoundingBox before = patchwork.bounding_box();
+		nested->add_component(new Circle(Vec2(300, 0), 1.f, Color()));
+		BoundingBox after = patchwork.bounding_box();
+		passed_test += test_assert(before.x_max == 1.f && after.x_max == 301.f && patchwork.area() == 302.f * 2.f, "Nested images");
+
+		std::cout << std::endl << "Test bounding boxes : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
+	static void test_packed()
+	{
+		int passed_test = 0;
+		int nb_of_test = 6;
+
+		std::cout << "Begin test suit for packed storage" << std::endl << std::endl;
+
+		auto fill = [](Image& img)
+		{
+			for (int i = 0; i < 20; ++i)
+			{
+				float x = (float)(i * 37 % 300) - 150.f, y = (float)(i * 53 % 200) - 100.f;
+				img.add_component(new Circle(Vec2(x, y), 5.f + i % 7, Color(i * 10, 0, 0)));
+				img.add_component(new Polygon({ { x, y }, { x + 30, y + 5 }, { x + 10, y + 25 } }, Color(0, i * 10, 0)));
+				img.add_component(new Ellipse(Vec2(y, x), Vec2(12, 4), Color(0, 0, i * 10)));
+				img.add_component(new Line(Vec2(x, -y), Vec2(40, 10), Color(i, i, i)));
+			}
+			img.annotate("packed");
+		};
+		//Compare the shapes of two images, position by position
+		auto same = [](Image& a, Image& b)
+		{
+			std::string sa, sb;
+			a.serialize(sa, BINARY);
+			b.serialize(sb, BINARY);
+			Image da, db;
+			da.deserialize(sa);
+			db.deserialize(sb);
+			if (da.components().size() != db.components().size() || da.get_annotation() != db.get_annotation())
+				return false;
+			for (std::size_t i = 0; i < da.components().size(); ++i)
+			{
+				Shape* x = da.components()[i];
+				Shape* y = db.components()[i];
+				BoundingBox bx = x->bounding_box(), by = y->bounding_box();
+				if (x->type() != y->type() || x->id() != y->id() || !(x->color() == y->color())
+					|| std::abs(bx.x_min - by.x_min) > 1e-3f || std::abs(bx.x_max - by.x_max) > 1e-3f
+					|| std::abs(bx.y_min - by.y_min) > 1e-3f || std::abs(bx.y_max - by.y_max) > 1e-3f)
+					return false;
+			}
+			return true;
+		};
+
+		//Packing keeps every shape, with its id, and the payloads
+		Image packed, pointers;
+		fill(packed);
+		fill(pointers);
+		std::string before, after, text_before, text_after;
+		packed.serialize(before, BINARY);
+		packed.serialize(text_before);
+		bool ok = packed.pack() && packed.packed() && packed.components().empty();
+		packed.serialize(after, BINARY);
+		packed.serialize(text_after);
+		passed_test += test_assert(ok && before == after && text_before == text_after, "Packing");
+
+		//Batched transforms give the same shapes as the virtual ones
+		packed.translate(Vec2(10, -5));
+		pointers.translate(Vec2(10, -5));
+		packed.homothety(Vec2(3, 4), 1.5f);
+		pointers.homothety(Vec2(3, 4), 1.5f);
+		packed.homothety(0.8f);
+		pointers.homothety(0.8f);
+		packed.rotate(Vec2(-20, 10), 0.7);
+		pointers.rotate(Vec2(-20, 10), 0.7);
+		packed.rotate(0.3f);
+		pointers.rotate(0.3f);
+		packed.centralSym(Vec2(5, 5));
+		pointers.centralSym(Vec2(5, 5));
+		packed.axialSym(Vec2(1, 2), Vec2(3, 1));
+		pointers.axialSym(Vec2(1, 2), Vec2(3, 1));
+		BoundingBox a = packed.bounding_box(), b = pointers.bounding_box();
+		passed_test += test_assert(same(packed, pointers) && std::abs(a.x_min - b.x_min) < 1e-3f && std::abs(a.y_max - b.y_max) < 1e-3f, "Batched transforms");
+
+		//Packed shapes are drawn, culled and collapsed as the others
+		Framebuffer fa(120, 90), fb(120, 90), pa(120, 90), pb(120, 90);
+		packed.display(fa, View(1.f, Vec2(40, 30)));
+		pointers.display(fb, View(1.f, Vec2(40, 30)));
+		packed.display_parallel(pa, 3, 16);
+		pointers.display_parallel(pb, 3, 16);
+		const Canvas::Counters& ca = fa.counters();
+		const Canvas::Counters& cb = fb.counters();
+		passed_test += test_assert(ca.drawn == cb.drawn && ca.culled == cb.culled && ca.culled > 0
+			&& memcmp(fa.data(), fb.data(), 120 * 90 * 4) == 0 && memcmp(pa.data(), pb.data(), 120 * 90 * 4) == 0, "Packed rendering");
+
+		//Edits keep working, deltas included, and unpacking gives the shapes back
+		std::string base_a, base_b;
+		packed.serialize(base_a, BINARY);
+		pointers.serialize(base_b, BINARY);
+		packed.acknowledge(packed.current_version());
+		pointers.acknowledge(pointers.current_version());
+		packed.remove_component(5);
+		pointers.remove_component(5);
+		packed.add_component(new Circle(Vec2(1, 1), 2.f, Color(1, 2, 3)));
+		pointers.add_component(new Circle(Vec2(1, 1), 2.f, Color(1, 2, 3)));
+		packed.mark_changed(10);
+		pointers.mark_changed(10);
+		std::string da, db;
+		packed.serialize_delta(da);
+		pointers.serialize_delta(db);
+		//The coordinates may differ in the last bits after the transforms, compare the shapes the deltas give
+		Image ra, rb;
+		ra.deserialize(base_a);
+		ra.deserialize(da);
+		rb.deserialize(base_b);
+		rb.deserialize(db);
+		std::map<Shape::Derivedtype, int> shapes_count;
+		std::map<Color, int> color_count;
+		packed.tally(shapes_count, color_count);
+		packed.unpack();
+		passed_test += test_assert(da.size() == db.size() && same(ra, rb) && ra.components().size() == 80 && shapes_count[Shape::CIRCLE] == 21 && shapes_count[Shape::LINE] == 20 && color_count[Color(1, 2, 3)] == 1
+			&& !packed.packed() && packed.components().size() == 80 && same(packed, pointers), "Packed edits");
+
+		//Removals in any order keep the painting order, the shapes and the boxes, through the compaction of the vertex pool too
+		Image thinned, reference;
+		fill(thinned);
+		fill(reference);
+		thinned.pack();
+		for (int k = 0; k < 50; ++k)
+		{
+			int index = (k * 7) % (80 - k);
+			thinned.remove_component(index);
+			reference.remove_component(index);
+		}
+		a = thinned.bounding_box(), b = reference.bounding_box();
+		passed_test += test_assert(same(thinned, reference) && thinned.packed() && a.x_min == b.x_min && a.x_max == b.x_max && a.y_min == b.y_min && a.y_max == b.y_max, "Removals");
+
+		//A shape made with new stays its owner's whatever the storage, the image giving back the id of its component
+		Circle owned(Vec2(7, 7), 3.f, Color(4, 5, 6));
+		Image loose, stored;
+		loose.add_component(new Circle(Vec2(0, 0), 1.f, Color()));
+		stored.add_component(new Circle(Vec2(0, 0), 1.f, Color()));
+		stored.pack();
+		uint32_t loose_id = loose.add_component(&owned);
+		uint32_t stored_id = stored.add_component(&owned);
+		stored.unpack();
+		passed_test += test_assert(loose_id == 2 && stored_id == 2 && loose.components()[1] == &owned && stored.components()[1] != &owned
+			&& stored.components()[1]->id() == stored_id && owned.radius() == 3.f, "Ownership");
+
+		std::cout << std::endl << "Test packed storage : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
+	static void test_affine()
+	{
+		int passed_test = 0;
+		int nb_of_test = 5;
+
+		std::cout << "Begin test suit for affine transforms" << std::endl << std::endl;
+
+		auto nearly = [](const Vec2& a, const Vec2& b) { return std::abs(a.x - b.x) < 1e-3f && std::abs(a.y - b.y) < 1e-3f; };
+
+		//A chain composed once maps the points as the transforms applied one after the other
+		Vec2 o(3, -2), axis(1, 2);
+		Affine chain = Affine::axial_symmetry(o, axis) * Affine::homothety(o, 1.5f) * Affine::rotation(o, 0.7) * Affine::translation(Vec2(5, 1));
+		bool same = true;
+		for (int i = 0; i < 10; ++i)
+		{
+			Vec2 p((float)(i * 7 % 11) - 5.f, (float)(i * 3 % 13) - 6.f);
+			Vec2 q = Affine::axial_symmetry(o, axis).apply(Affine::homothety(o, 1.5f).apply(Affine::rotation(o, 0.7).apply(Affine::translation(Vec2(5, 1)).apply(p))));
+			same = same && nearly(chain.apply(p), q);
+		}
+		Vec2 on_axis = o + 2.f * axis;
+		passed_test += test_assert(same && std::abs(chain.scale() - 1.5f) < 1e-4f && nearly(Affine::axial_symmetry(o, axis).apply(on_axis), on_axis)
+			&& nearly((Affine::central_symmetry(o) * Affine::central_symmetry(o)).apply(axis), axis) && Affine::translation(o).is_translation() && !chain.is_translation(), "Composition");
+
+		//Every level available must give the very same results as the scalar one, odd sizes check the remainders
+		Simd::Level best = Simd::detect();
+		std::vector<Vec2> points, expected;
+		std::vector<float> x, y;
+		for (int i = 0; i < 37; ++i)
+			points.push_back(Vec2(60.f * (float)cos(i * 0.17), 20.f * (float)sin(i * 0.31 + 1) + 0.25f));
+		for (auto& p : points)
+			expected.push_back(chain.apply(p));
+		same = true;
+		for (int level = Simd::SCALAR; level <= best; ++level)
+		{
+			Simd::set_level((Simd::Level)level);
+			for (std::size_t n = 0; n <= points.size(); n += 9)
+			{
+				std::vector<Vec2> aos(points.begin(), points.begin() + n);
+				x.clear(), y.clear();
+				for (auto& p : aos)
+					x.push_back(p.x), y.push_back(p.y);
+				Simd::transform(chain, aos.data(), n);
+				Simd::transform(chain, x.data(), y.data(), n);
+				for (std::size_t k = 0; k < n; ++k)
+					same = same && memcmp(&aos[k], &expected[k], sizeof(Vec2)) == 0 && x[k] == expected[k].x && y[k] == expected[k].y;
+			}
+		}
+		Simd::set_level(best);
+		passed_test += test_assert(same, "Kernels");
+
+		//The transforms of a polygon are its affine maps
+		Polygon a({ { 0, 0 }, { 10, 0 }, { 10, 5 }, { 0, 5 } }, Color(1, 2, 3));
+		Polygon b = a;
+		a.translate(Vec2(5, 1));
+		a.rotate(o, 0.7);
+		a.homothety(o, 1.5f);
+		a.axialSym(o, axis);
+		b.transform(chain);
+		BoundingBox ba = a.bounding_box(), bb = b.bounding_box();
+		Polygon c({ { 2, 2 }, { 4, 2 }, { 4, 4 } }, Color(1, 2, 3));
+		c.rotate(Vec2(3, 3), PI);
+		BoundingBox bc = c.bounding_box();
+		passed_test += test_assert(nearly(Vec2(ba.x_min, ba.y_min), Vec2(bb.x_min, bb.y_min)) && nearly(Vec2(ba.x_max, ba.y_max), Vec2(bb.x_max, bb.y_max))
+			&& std::abs(a.area() - b.area()) < 1e-2f && nearly(Vec2(bc.x_min, bc.y_min), Vec2(2, 2)) && nearly(Vec2(bc.x_max, bc.y_max), Vec2(4, 4)), "Polygon transforms");
+
+		//A line is drawn unscaled : its transforms move its point and turn its direction, which keeps its length, its homothety included
+		Line l(Vec2(2, 1), Vec2(6, 8), Color(1, 2, 3));
+		Line turned = l;
+		l.homothety(o, 1.5f);
+		turned.transform(Affine::rotation(o, PI / 2) * Affine::homothety(o, 2.f));
+		Image lines;
+		lines.add_component(new Line(Vec2(2, 1), Vec2(6, 8), Color(1, 2, 3)));
+		lines.homothety(o, 1.5f);
+		Line* in_image = static_cast<Line*>(lines.components()[0]);
+		passed_test += test_assert(nearly(l.point(), o + 1.5f * (Vec2(2, 1) - o)) && nearly(l.direction(), Vec2(6, 8))
+			&& nearly(turned.point(), Affine::rotation(o, PI / 2).apply(o + 2.f * (Vec2(2, 1) - o))) && nearly(turned.direction(), Vec2(-8, 6))
+			&& nearly(in_image->point(), l.point()) && nearly(in_image->direction(), l.direction()), "Line transforms");
+
+		//An image walks its components once for the whole chain, packed or not
+		Image chained, composed, packed;
+		for (int i = 0; i < 15; ++i)
+		{
+			float px = (float)(i * 37 % 300) - 150.f, py = (float)(i * 53 % 200) - 100.f;
+			Image* images[] = { &chained, &composed, &packed };
+			for (Image* img : images)
+			{
+				img->add_component(new Circle(Vec2(px, py), 5.f + i % 7, Color(i * 10, 0, 0)));
+				img->add_component(new Polygon({ { px, py }, { px + 30, py + 5 }, { px + 10, py + 25 } }, Color(0, i * 10, 0)));
+			}
+		}
+		packed.pack();
+		chained.translate(Vec2(5, 1));
+		chained.rotate(o, 0.7);
+		chained.homothety(o, 1.5f);
+		chained.axialSym(o, axis);
+		composed.transform(chain);
+		packed.transform(chain);
+		packed.unpack();
+		ba = chained.bounding_box(), bb = composed.bounding_box();
+		same = chained.components().size() == composed.components().size() && composed.components().size() == packed.components().size()
+			&& std::abs(ba.x_min - bb.x_min) < 1e-2f && std::abs(ba.y_max - bb.y_max) < 1e-2f;
+		for (std::size_t k = 0; same && k < composed.components().size(); ++k)
+		{
+			BoundingBox u = chained.components()[k]->bounding_box(), v = composed.components()[k]->bounding_box(), w = packed.components()[k]->bounding_box();
+			same = std::abs(u.x_min - v.x_min) < 1e-2f && std::abs(u.y_max - v.y_max) < 1e-2f && v.x_min == w.x_min && v.y_max == w.y_max;
+		}
+		passed_test += test_assert(same, "Image transform");
+
+		std::cout << std::endl << "Test affine transforms : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
+	static void test_pending()
+	{
+		int passed_test = 0;
+		int nb_of_test = 4;
+
+		std::cout << "Begin test suit for pending transforms" << std::endl << std::endl;
+
+		auto nearly = [](const BoundingBox& a, const BoundingBox& b)
+		{
+			return std::abs(a.x_min - b.x_min) < 1e-2f && std::abs(a.x_max - b.x_max) < 1e-2f && std::abs(a.y_min - b.y_min) < 1e-2f && std::abs(a.y_max - b.y_max) < 1e-2f;
+		};
+
+		//The transforms are only composed, then applied at once as each shape would have applied them (lines keep their length, ellipses get no rotation)
+		Circle circle(Vec2(30, -12), 25.f, Color(255, 0, 0));
+		Polygon polygon({ { 0, 0 }, { 40, 4 }, { 20, 30 } }, Color(0, 0, 255));
+		Line line(Vec2(-20, 10), Vec2(30, 5), Color(0, 0, 0));
+		Ellipse ellipse(Vec2(-40, 20), Vec2(30, 12), Color(0, 255, 0));
+		Shape* loose[] = { &circle, &polygon, &line, &ellipse };
+		Image lazy;
+		lazy.add_component(new Circle(circle));
+		lazy.add_component(new Polygon(polygon));
+		lazy.add_component(new Line(line));
+		lazy.add_component(new Ellipse(ellipse));
+		Shape* first = lazy.components()[0];
+		BoundingBox before = first->bounding_box();
+		Vec2 o(3, -2);
+		lazy.translate(Vec2(5, 1));
+		lazy.rotate(o, 0.7);
+		lazy.homothety(o, 1.5f);
+		lazy.translate(Vec2(-3, 2));
+		bool untouched = first->bounding_box().x_min == before.x_min;
+		for (Shape* shape : loose)
+		{
+			shape->translate(Vec2(5, 1));
+			shape->rotate(o, 0.7);
+			shape->homothety(o, 1.5f);
+			shape->translate(Vec2(-3, 2));
+		}
+		bool same = lazy.components().size() == 4;
+		for (std::size_t k = 0; same && k < 4; ++k)
+			same = nearly(lazy.components()[k]->bounding_box(), loose[k]->bounding_box());
+		passed_test += test_assert(untouched && same, "Composed transforms");
+
+		//A pending translation is drawn by moving the view, lines included, and moves the bounding box
+		Image moved, reference;
+		Image* images[] = { &moved, &reference };
+		for (Image* img : images)
+		{
+			for (int i = 0; i < 12; ++i)
+			{
+				float x = (float)(i * 37 % 200) - 100.f, y = (float)(i * 53 % 140) - 70.f;
+				img->add_component(new Circle(Vec2(x, y), 4.f + i % 5, Color(i * 20, 0, 0)));
+				img->add_component(new Polygon({ { x, y }, { x + 30, y + 6 }, { x + 10, y + 24 } }, Color(0, i * 20, 0)));
+				img->add_component(new Line(Vec2(y, x), Vec2(20, 8), Color(0, 0, i * 20)));
+			}
+			img->origin(Vec2(-30, 12));
+		}
+		reference.flatten();
+		first = moved.components()[0];
+		moved.translate(Vec2(12, -6));
+		reference.translate(Vec2(12, -6));
+		reference.flatten();
+		before = first->bounding_box();
+		Framebuffer fa(200, 150), fb(200, 150), pa(480, 360), pb(480, 360);
+		moved.display(fa, View(0.5f, Vec2(100, 75)));
+		reference.display(fb, View(0.5f, Vec2(100, 75)));
+		//Unscaled, so moving the view rounds as moving the shapes (the image fits)
+		moved.display_parallel(pa, 3, 32);
+		reference.display_parallel(pb, 3, 32);
+		BoundingBox ba = moved.bounding_box(), bb = reference.bounding_box();
+		passed_test += test_assert(first->bounding_box().x_min == before.x_min && memcmp(fa.data(), fb.data(), 200 * 150 * 4) == 0
+			&& memcmp(pa.data(), pb.data(), 480 * 360 * 4) == 0 && fa.counters().drawn == fb.counters().drawn && ba.x_min == bb.x_min && ba.y_max == bb.y_max, "Translation drawn by the view");
+
+		//Deltas carry the applied transform, and nothing when it came back to the identity
+		std::string base, unchanged, back, delta;
+		moved.serialize(base, BINARY);
+		moved.acknowledge(moved.current_version());
+		moved.serialize_delta(unchanged);
+		moved.translate(Vec2(7, 7));
+		moved.translate(Vec2(-7, -7));
+		moved.serialize_delta(back);
+		moved.translate(Vec2(7, 7));
+		moved.serialize_delta(delta);
+		Image peer;
+		peer.deserialize(base);
+		peer.deserialize(delta);
+		ba = moved.bounding_box(), bb = peer.bounding_box();
+		passed_test += test_assert(back.size() == unchanged.size() && delta.size() > back.size() && nearly(ba, bb) && peer.components().size() == 36, "Deltas");
+
+		//A nested image gets the transforms of its parent as its own
+		Image parent, child;
+		child.add_component(new Circle(Vec2(10, 0), 5.f, Color(255, 0, 0)));
+		child.add_component(new Line(Vec2(0, 10), Vec2(10, 0), Color(0, 0, 0)));
+		parent.add_component(&child);
+		parent.homothety(Vec2(0, 0), 2.f);
+		parent.translate(Vec2(1, 1));
+		parent.flatten();
+		BoundingBox c = child.components()[0]->bounding_box(), l = child.components()[1]->bounding_box();
+		BoundingBox expected_c, expected_l;
+		expected_c.x_min = 11.f, expected_c.x_max = 31.f, expected_c.y_min = -9.f, expected_c.y_max = 11.f;
+		expected_l.x_min = 1.f, expected_l.x_max = 11.f, expected_l.y_min = 21.f, expected_l.y_max = 21.f;
+		passed_test += test_assert(nearly(c, expected_c) && nearly(l, expected_l) && nearly(parent.bounding_box(), child.bounding_box()), "Nested images");
+		parent.components().clear();
+
+		std::cout << std::endl << "Test pending transforms : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
+	static void test_factory()
+	{
+		int passed_test = 0;
+		int nb_of_test = 4;
+
+		std::cout << "Begin test suit for shape factory" << std::endl << std::endl;
+
+		//Released slots are reused, clear keeps the chunks and makes the next objects in the same slots
+		Pool<Circle> pool;
+		std::vector<Circle*> circles;
+		for (int i = 0; i < 40; ++i)
+			circles.push_back(pool.make(Vec2((float)i, 0), 1.f, Color(i, 0, 0)));
+		std::size_t capacity = pool.capacity();
+		Circle* seventh = circles[7];
+		pool.release(seventh);
+		Circle* reused = pool.make(Vec2(0, 0), 2.f, Color());
+		Circle outside(Vec2(0, 0), 1.f, Color());
+		bool owned = pool.owns(circles[0]) && pool.owns(circles[39]) && !pool.owns(&outside);
+		pool.clear();
+		Circle* first = pool.make(Vec2(0, 0), 3.f, Color());
+		passed_test += test_assert(reused == seventh && owned && first == circles[0] && pool.size() == 1 && pool.capacity() == capacity && capacity >= 40, "Pool");
+
+		//One pool per type
+		Factory<Circle, Polygon> factory;
+		Polygon* polygon = factory.make<Polygon>(std::vector<Vec2>({ { 0, 0 }, { 4, 0 }, { 0, 4 } }), Color(1, 2, 3));
+		Circle* circle = factory.make<Circle>(Vec2(1, 1), 2.f, Color(4, 5, 6));
+		bool typed = factory.size() == 2 && factory.owns(polygon) && factory.owns(circle) && !factory.owns(&outside) && polygon->area() == 8.f;
+		factory.release(polygon);
+		typed = typed && factory.size() == 1;
+		factory.clear();
+		passed_test += test_assert(typed && factory.size() == 0 && factory.capacity() > 0, "Factory");
+
+		//Receiving an image again and again makes its shapes in the same memory
+		Image source;
+		for (int i = 0; i < 50; ++i)
+		{
+			source.add_component(new Circle(Vec2((float)i, 0), 1.f + i % 3, Color(i, 0, 0)));
+			source.add_component(new Polygon({ { (float)i, 0 }, { (float)i + 5, 0 }, { (float)i, 5 } }, Color(0, i, 0)));
+			source.add_component(new Line(Vec2(0, (float)i), Vec2(5, 5), Color(0, 0, i)));
+			source.add_component(new Ellipse(Vec2((float)i, 10), Vec2(4, 2), Color(i, i, 0)));
+		}
+		std::string binary, text;
+		source.serialize(binary, BINARY);
+		source.serialize(text);
+		Image received;
+		received.deserialize(binary);
+		std::vector<Shape*> addresses = received.components();
+		bool same = true;
+		for (int i = 0; i < 3; ++i)
+		{
+			received.deserialize(text);
+			received.deserialize(binary);
+			same = same && received.components() == addresses;
+		}
+		received.pack();
+		received.unpack();
+		passed_test += test_assert(same && addresses.size() == 200 && received.components().size() == 200, "Repeated deserialization");
+
+		//Removed shapes go back to the pools, shapes made with new are left to their owner
+		Image image;
+		Circle* made = image.make<Circle>(Vec2(0, 0), 1.f, Color(1, 1, 1));
+		image.add_component(made);
+		image.add_component(&outside);
+		image.remove_component(0);
+		Circle* again = image.make<Circle>(Vec2(0, 0), 2.f, Color(2, 2, 2));
+		image.add_component(again);
+		image.remove_component(0);
+		passed_test += test_assert(again == made && outside.radius() == 1.f && image.components().size() == 1 && image.components()[0] == again, "Image pools");
+
+		std::cout << std::endl << "Test shape factory : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
+	static void test_reader()
+	{
+		int passed_test = 0;
+		int nb_of_test = 4;
+
+		std::cout << "Begin test suit for message reader" << std::endl << std::endl;
+
+		auto frame = [](Message::Opcode opcode, unsigned char flags, uint32_t request_id, const std::string& body)
+		{
+			Message msg(opcode, flags, request_id);
+			msg.set_body(body);
+			return std::string(msg.data(), msg.length());
+		};
+		//Feed the bytes to the reader by reads of at most chunk bytes, collecting every message extracted (opcode, request ID and body)
+		struct Received
+		{
+			Message::Opcode opcode;
+			unsigned char flags;
+			uint32_t request_id;
+			std::string body;
+		};
+		auto feed = [](Message_reader& reader, const std::string& bytes, std::size_t chunk, std::vector<Received>& received)
+		{
+			for (std::size_t done = 0; done < bytes.size();)
+			{
+				std::size_t size;
+				char* to = reader.prepare(size);
+				std::size_t n = std::min(std::min(size, chunk), bytes.size() - done);
+				memcpy(to, bytes.data() + done, n);
+				reader.commit(n);
+				done += n;
+				Message_view view;
+				while (reader.next(view))
+				{
+					Received r = { view.opcode, view.flags, view.request_id, std::string(view.body, view.length) };
+					received.push_back(r);
+				}
+			}
+		};
+
+		//Byte by byte, every partial header and body waits for the rest
+		std::string stream = frame(Message::IMAGE, Message::BINARY_BODY, 7, "circle 1 2 3") + frame(Message::ACK, 0, 8, std::string("\0\0\0\5", 4));
+		Message_reader slow;
+		std::vector<Received> received;
+		feed(slow, stream, 1, received);
+		passed_test += test_assert(received.size() == 2 && received[0].opcode == Message::IMAGE && received[0].flags == Message::BINARY_BODY
+			&& received[0].request_id == 7 && received[0].body == "circle 1 2 3" && received[1].opcode == Message::ACK && received[1].request_id == 8
+			&& received[1].body == std::string("\0\0\0\5", 4) && !slow.error(), "Byte by byte");
+
+		//Several frames in one read, an empty body included, are all extracted before the next read
+		stream = frame(Message::HELLO, 0, 1, "a") + frame(Message::GET, 0, 2, "") + frame(Message::ANNOTATE, 0, 3, "note");
+		Message_reader fast;
+		received.clear();
+		feed(fast, stream, stream.size(), received);
+		Message_view view;
+		passed_test += test_assert(received.size() == 3 && received[0].body == "a" && received[1].opcode == Message::GET && received[1].body.empty()
+			&& received[2].request_id == 3 && received[2].body == "note" && !fast.next(view) && !fast.error(), "Several frames in one read");
+
+		//A frame bigger than the buffer makes it grow, split across reads and after a frame already consumed
+		std::string big(3 * Message_reader::min_read_length + 5, 'x');
+		for (std::size_t i = 0; i < big.size(); ++i)
+			big[i] = (char)('a' + i % 26);
+		stream = frame(Message::IMAGE, 0, 4, "small") + frame(Message::DELTA, Message::BINARY_BODY, 5, big) + frame(Message::ACK, 0, 6, "end");
+		Message_reader growing;
+		received.clear();
+		feed(growing, stream, 1000, received);
+		passed_test += test_assert(received.size() == 3 && received[0].body == "small" && received[1].opcode == Message::DELTA && received[1].body == big
+			&& received[2].body == "end" && !growing.error(), "Frame bigger than the buffer");
+
+		//A length above max_body_length is rejected for good, the connection can't be trusted anymore
+		std::string corrupted = frame(Message::IMAGE, 0, 9, "");
+		write_uint32(&corrupted[0], (uint32_t)Message::max_body_length + 1);
+		Message_reader rejecting;
+		received.clear();
+		feed(rejecting, corrupted + frame(Message::ACK, 0, 10, "ok"), 64, received);
+		std::size_t offered;
+		rejecting.prepare(offered);
+		passed_test += test_assert(received.empty() && rejecting.error() && !rejecting.next(view) && offered < Message_reader::min_read_length + 64, "Oversize length");
+
+		std::cout << std::endl << "Test message reader : " << (int)(((float)passed_test / nb_of_test) * 100) << "% OK !" << std::endl;
+	}
+
 	static void run_tests()
 	{
 		test_circle();
@@ -127,5 +1336,35 @@ namespace Shape_test
 		test_ellipse();
 		std::cout << std::endl;
 		test_line();
+		std::cout << std::endl;
+		test_binary();
+		std::cout << std::endl;
+		test_delta();
+		std::cout << std::endl;
+		test_raster();
+		std::cout << std::endl;
+		test_framebuffer();
+		std::cout << std::endl;
+		test_simd();
+		std::cout << std::endl;
+		test_cache();
+		std::cout << std::endl;
+		test_view();
+		std::cout << std::endl;
+		test_culling();
+		std::cout << std::endl;
+		test_index();
+		std::cout << std::endl;
+		test_bounding_box();
+		std::cout << std::endl;
+		test_packed();
+		std::cout << std::endl;
+		test_affine();
+		std::cout << std::endl;
+		test_pending();
+		std::cout << std::endl;
+		test_factory();
+		std::cout << std::endl;
+		test_reader();
 	}
 }
\ No newline at end of file